@@ -27,12 +27,13 @@
  */
 
 #include "light_files.h"
+#include <string.h>
 
 /*
 general idea: file name == key (uint8_t)
 assumption: block size is bigger than single batch of data to write at once.
 limitation: 
-    * you can only work at one file at a time
+    * you can only write one file at a time
     * library does not control max file size - user should add it to the file content
 
 Block structure
@@ -47,36 +48,326 @@ Block structure
 2B size
     special values
         0xff - file not closed
+4B CRC-32 of the data, next block and size (LF_USE_CRC)
+
+Leading block attributes (LF_USE_COMPRESSION, LF_USE_RECORDS), after the block header
+1B flags, stored inverted so they can be programmed without erasing
+    1b - compressed (LSb)
+    1b - pending, written in a transaction (LF_USE_TRANSACTIONS)
+    1b - committed, programmed once the transaction is complete
+    4b - window bits of the compressor (MSb)
+4B content size (before compression)
+    special values
+        0xffffffff - file not saved
+2B record size (LF_USE_RECORDS)
+    special values
+        0xffff - not a record file
+
+Transactions
+    the files written in a transaction are pending - they are not visible until
+    the commit record is written. Then the old versions of the files are deleted,
+    the new ones are marked as committed and the commit record is erased. lf_init
+    finishes an interrupted commit, or deletes the pending files if the commit
+    record was not written.
+
+Record files
+    the blocks hold only whole records, the rest of a full block is left
+    unused, so the position of a record is computed from its index
+
+System blocks, info 0x7f, the size field keeps the type of the block
+    0xffff - key-value log (LF_USE_KV)
+    0x0000 - commit record of a transaction (LF_USE_TRANSACTIONS)
+    0xfffe - table of the bad blocks (LF_USE_BAD_BLOCKS)
+    0xfffd - swap record of a copied file (LF_USE_OVERWRITE, LF_USE_COPY)
+
+Key-value log blocks, the next block field keeps the sequence number of the
+block (the newest block holds the newest records), the records follow the
+block header:
+1B value length (0xff - end of the log)
+2B key
+nB value
+1B commit mark, 0x00 once the record is complete
+
+Bad block table, the entries follow the block header:
+2B retired block (0xffff - end of the table)
+2B replacement, the block holding its data (0xffff - none)
+    a block which fails to program is copied to a free block, and the chains
+    keep referring to the failed one - the driver calls are redirected to the
+    replacement. If the table block fails, the table is written to a new one,
+    so all the tables found by lf_init are merged.
+
+Swap record, the entries follow the block header:
+2B old leading block
+2B new leading block
+2B first block shared by both chains (0xffff - none)
+    a file changed by a copy (lf_truncate, lf_overwrite, lf_rename) has two
+    chains until the old leading block is demoted to a following block, which
+    makes the new chain the file. Then the old blocks up to the shared ones and
+    the record are erased. lf_init erases the new chain if the old leading
+    block was not demoted, otherwise it finishes the erasing.
+
+Compression
+    LZSS - a flags byte (LSb first, 1 - literal) precedes each group of 8 items,
+    a literal is 1 byte, a match is 2 bytes: 12 bits of distance - 1 and 4 bits
+    of length - 3. A match may overlap the bytes it produces.
+
+Program pages
+    if the memory reports a page size, data is programmed page by page and
+    no write crosses a page boundary. With LF_PAGE_BUFFER_SIZE set the data
+    is collected in RAM, so every page is programmed once from its beginning
+    (the header area is left erased and programmed last).
+
+Workspace
+    with LF_USE_WORKSPACE the page buffer, the key-value index, the bad block
+    table and the CRC table are carved from the workspace of lf_mount in this
+    order, each part aligned to 4 bytes. The CRC table is left out when the
+    workspace is too small for it.
+
+Striped volumes
+    the blocks are numbered alternately across the devices (LF_USE_STRIPING),
+    and a free block is searched on the device following the device of the
+    previously allocated block, so the consecutive blocks of a file are on
+    different devices.
+
+Rewritable memories
+    blocks are never erased. Deleting a file only marks the info byte of its
+    blocks as free, and the remaining content is overwritten when reused.
+
+Open files
+    the written file, the open readers and the deleted file are kept in RAM.
+    A file can not be opened while it is written or deleted, and can not be
+    deleted while it is open. With LF_USE_LOCK only these checks, the search
+    cursor and the allocation of free blocks are done under the lock, the
+    content is read, programmed and erased without it.
 */
 
-#define LF_BLOCK_HEADER_SIZE (5)
-#define LF_CONTENT_MAX_SIZE (sMemory.blockSize - LF_BLOCK_HEADER_SIZE)
+// memory geometry, constant if fixed at compile time
+#ifdef LF_BLOCK_SIZE
+#define LF_MEMORY_BLOCK_SIZE ((uint16_t)(LF_BLOCK_SIZE))
+#else
+#define LF_MEMORY_BLOCK_SIZE (sMemory.blockSize)
+#endif
+#ifdef LF_BLOCK_COUNT
+#define LF_MEMORY_BLOCK_COUNT ((uint16_t)(LF_BLOCK_COUNT))
+#else
+#define LF_MEMORY_BLOCK_COUNT (sMemory.blockCount)
+#endif
+#ifdef LF_PAGE_SIZE
+#define LF_MEMORY_PAGE_SIZE ((uint16_t)(LF_PAGE_SIZE))
+#else
+#define LF_MEMORY_PAGE_SIZE (sMemory.pageSize)
+#endif
+#ifdef LF_MEMORY_FLAGS
+#define LF_MEMORY_REWRITABLE ((LF_MEMORY_FLAGS) & LF_MEMORY_FLAG_REWRITABLE)
+#else
+#define LF_MEMORY_REWRITABLE (sMemory.flags & LF_MEMORY_FLAG_REWRITABLE)
+#endif
+#ifdef LF_DEVICE_COUNT
+#define LF_MEMORY_DEVICE_COUNT ((uint8_t)(LF_DEVICE_COUNT))
+#else
+#define LF_MEMORY_DEVICE_COUNT (sMemory.deviceCount)
+#endif
+
+#define LF_USE_FILE_ATTRIBUTES (LF_USE_COMPRESSION || LF_USE_RECORDS || LF_USE_TRANSACTIONS)
+
+#define LF_BLOCK_LINK_SIZE (5) // info, next block and size
+#if LF_USE_CRC
+#define LF_CRC_SIZE (4)
+#else
+#define LF_CRC_SIZE (0)
+#endif
+#define LF_BLOCK_HEADER_SIZE (LF_BLOCK_LINK_SIZE + LF_CRC_SIZE)
+#if LF_USE_RECORDS
+#define LF_ATTRIBUTES_SIZE (7)
+#elif LF_USE_FILE_ATTRIBUTES
+#define LF_ATTRIBUTES_SIZE (5)
+#else
+#define LF_ATTRIBUTES_SIZE (0)
+#endif
+#define LF_LEADING_HEADER_SIZE (LF_BLOCK_HEADER_SIZE + LF_ATTRIBUTES_SIZE)
+#define LF_DATA_OFFSET(leading) ((leading) ? LF_LEADING_HEADER_SIZE : LF_BLOCK_HEADER_SIZE)
 #define LF_BLOCK_NONE ((uint16_t)0xffff)
 #define LF_KEY_FREE ((uint8_t)0xff)
 #define LF_KEY_MAX ((uint8_t)126)
 #define LF_INFO_LEADING_MASK (0x80)
+#define LF_KEY_ALL ((uint8_t)0xfe) // deleted key during formatting
+#define LF_SIZE_UNKNOWN ((uint32_t)0xffffffff)
+#define LF_RECORD_SIZE_NONE ((uint16_t)0xffff)
+#define LF_BLOCK_SIZE_UNSAVED ((uint16_t)0xffff) // the block is still written
+#define LF_INFO_SYSTEM ((uint8_t)0x7f) // internal block, its type is kept in the size field
+#define LF_SYSTEM_KV ((uint16_t)0xffff)
+#define LF_SYSTEM_COMMIT ((uint16_t)0x0000)
+#define LF_SYSTEM_BAD_BLOCKS ((uint16_t)0xfffe)
+#define LF_SYSTEM_SWAP ((uint16_t)0xfffd)
+#define LF_BAD_BLOCK_ENTRY_SIZE (4)
+
+// key-value records
+#define LF_KV_RECORD_HEADER_SIZE (3)
+#define LF_KV_RECORD_SIZE(length) (LF_KV_RECORD_HEADER_SIZE + (length) + 1)
+#define LF_KV_LENGTH_END ((uint8_t)0xff)
+#define LF_KV_COMMITTED ((uint8_t)0x00)
+
+// file flags
+#define LF_FILE_FLAG_COMPRESSED (0x01)
+#define LF_FILE_FLAG_PENDING (0x02)
+#define LF_FILE_FLAG_COMMITTED (0x04)
+#define LF_FILE_WINDOW_SHIFT (4)
+
+// compression
+#define LF_WINDOW_BITS_MIN (4)
+#define LF_WINDOW_BITS_MAX (12)
+#define LF_MATCH_MIN (3)
+#define LF_MATCH_MAX (18)
+#define LF_GROUP_MAX_SIZE (1 + 8 * 2)
+
+// bytes copied through a buffer on the stack at once
+#define LF_STACK_BUFFER_SIZE (16)
+#define LF_CHAIN_WINDOW (LF_STACK_BUFFER_SIZE / 2) // blocks of a chain erased from its end at once
 
 // error macro
 #define LF_ASSERT(cond, ret) if(cond) {return ret;}
 
 // memory info
-static lf_memory_config sMemory;
-
-// file info
-static uint16_t sFirstBlock = LF_BLOCK_NONE;
-static uint16_t sCurrentBlock = LF_BLOCK_NONE;
-static uint16_t sNextBlock = LF_BLOCK_NONE;
-static uint16_t sCursor = 0;
-static uint16_t sSize = 0;
-static uint8_t sKey = LF_KEY_FREE;
-static enum {
+LF_STATE lf_memory_config sMemory;
+
+// written file info
+LF_STATE uint16_t sFirstBlock = LF_BLOCK_NONE;
+LF_STATE uint16_t sCurrentBlock = LF_BLOCK_NONE;
+LF_STATE uint16_t sNextBlock = LF_BLOCK_NONE;
+LF_STATE uint16_t sCursor = 0;
+LF_STATE uint8_t sKey = LF_KEY_FREE;
+LF_STATE uint8_t sFlags = 0;
+LF_STATE uint32_t sContentSize = 0;
+#if LF_USE_RECORDS
+LF_STATE uint16_t sRecordSize = 0; // 0 if the file is not a record file
+#endif
+#if LF_USE_CRC
+LF_STATE uint32_t sCrc = 0;
+#endif
+LF_STATE enum {
     LF_MODE_NONE,
     LF_MODE_READING,
     LF_MODE_WRITING
 } sEditMode = LF_MODE_NONE;
 
-static uint16_t sBlock = 0;
-static uint16_t sLastFreeBlock = LF_BLOCK_NONE;
+// read file info (lf_open)
+LF_STATE lf_reader sReader;
+
+// open readers and the key being deleted
+LF_STATE lf_reader *sReaders = NULL;
+LF_STATE uint8_t sDeletedKey = LF_KEY_FREE;
+
+LF_STATE uint16_t sBlock = 0;
+LF_STATE uint16_t sLastFreeBlock = LF_BLOCK_NONE;
+
+// the blocks allocated by the writer, skipped by the allocator until their headers are
+// programmed, changed and read with the lock held
+LF_STATE struct {
+    uint16_t current;
+    uint16_t next;
+} sWritten = {LF_BLOCK_NONE, LF_BLOCK_NONE};
+
+#if LF_USE_TRANSACTIONS
+// keys written in the transaction
+LF_STATE struct {
+    uint8_t active;
+    uint8_t committing;
+    uint8_t keys[(LF_KEY_MAX + 8) / 8];
+} sTxn;
+#define LF_TXN_HAS(key) (sTxn.keys[(key) >> 3] & (1u << ((key) & 7)))
+#endif
+
+#if LF_USE_TAIL
+// the block being written and its data already programmed, read by the followers with the lock held
+LF_STATE struct {
+    uint16_t block; // LF_BLOCK_NONE if no file is written
+    uint16_t flushed;
+} sTail = {LF_BLOCK_NONE, 0};
+#endif
+
+#if LF_USE_BAD_BLOCKS
+// a retired block and the block holding its data
+typedef struct {
+    uint16_t block;
+    uint16_t replacement; // LF_BLOCK_NONE if the data was not moved
+} bad_block_t;
+
+// the table is changed under the lock and read without it, an entry is complete before it is counted
+LF_STATE struct {
+    uint16_t tableBlock; // LF_BLOCK_NONE until a block is retired
+    uint16_t saved; // entries programmed to the table block
+    uint16_t count;
+#if LF_USE_WORKSPACE
+    bad_block_t *entries; // in the workspace
+#else
+    bad_block_t entries[LF_BAD_BLOCKS_MAX];
+#endif
+} sBad;
+#define LF_IS_BAD(block) is_bad(block)
+#else
+#define LF_IS_BAD(block) (0)
+#endif
+
+#if LF_USE_LOCK
+#define LF_LOCK() lf_app_lock()
+#define LF_UNLOCK() lf_app_unlock()
+#else
+#define LF_LOCK()
+#define LF_UNLOCK()
+#endif
+
+#if LF_PAGE_BUFFER_SIZE > 0
+#if LF_USE_WORKSPACE
+LF_STATE uint8_t *sPageBuffer; // in the workspace
+#else
+LF_STATE uint8_t sPageBuffer[LF_PAGE_BUFFER_SIZE];
+#endif
+#endif
+
+#if LF_USE_WORKSPACE
+// the buffers are carved from it by lf_init, each part is aligned to 4 bytes
+#define LF_WORKSPACE_ALIGN(size) (((size) + 3) & ~(size_t)3)
+LF_STATE struct {
+    uint8_t *ptr; // NULL until lf_mount
+    size_t size;
+} sWorkspace;
+#endif
+
+#if LF_USE_COMPRESSION
+// compressor of the written file, the workspace holds the window, the lookahead and the output
+LF_STATE struct {
+    uint8_t *window; // NULL if the file is not compressed
+    uint16_t windowMask;
+    uint16_t windowPos;
+    uint16_t windowFill;
+    uint8_t *lookahead;
+    uint8_t lookaheadLength;
+    uint8_t *output;
+    uint8_t outputLength;
+    uint8_t flagsPos;
+    uint8_t itemCount;
+} sEncoder;
+#endif
+
+// statistics and tracing
+#if LF_USE_STATS
+LF_STATE lf_stats sStats;
+#define LF_STATS_ADD(field, value) (sStats.field += (value))
+#else
+#define LF_STATS_ADD(field, value)
+#endif
+
+#if LF_USE_TRACE
+LF_STATE lf_trace_callback sTrace = NULL;
+#define LF_TRACE_RETURN(call, expression) \
+    if(sTrace == NULL) {return expression;} \
+    sTrace(call, 0, LF_RESULT_SUCCESS); \
+    lf_result_t traceResult = expression; \
+    sTrace(call, 1, traceResult); \
+    return traceResult;
+#else
+#define LF_TRACE_RETURN(call, expression) return expression;
+#endif
 
 typedef struct {
     uint16_t block;
@@ -84,342 +375,3735 @@ typedef struct {
     uint16_t size;
 } block_info_t;
 
-static void blockIncrement(void)
-{
-    sBlock = (sBlock >= sMemory.blockCount - 1) ? 0 : (sBlock + 1);
-}
+#if LF_USE_KV
+// position of the newest record of a key
+typedef struct {
+    uint16_t key;
+    uint16_t block; // LF_BLOCK_NONE if the entry is empty
+    uint16_t offset;
+    uint8_t length;
+} kv_entry_t;
 
-static lf_result_t findFreeBlock(uint16_t *freeBlock)
-{
-    lf_result_t result;
+typedef struct {
+    uint16_t block;
+    uint16_t sequence;
+    uint16_t end; // offset of the next record
+    uint16_t dead; // bytes of the outdated records
+} kv_block_t;
 
-    *freeBlock = LF_BLOCK_NONE;
-    uint16_t startBlock = sBlock;
+// the index is built on the first use, the log blocks are sorted from the oldest,
+// one more block than LF_KV_MAX_BLOCKS is used while the store is compacted
+LF_STATE struct {
+    uint8_t loaded;
+    uint8_t blockCount;
+    kv_block_t blocks[LF_KV_MAX_BLOCKS + 1];
+#if LF_USE_WORKSPACE
+    kv_entry_t *index; // in the workspace
+#else
+    kv_entry_t index[LF_KV_INDEX_SIZE];
+#endif
+} sKv;
+#endif
 
-    do
+#if LF_USE_CRC
+#if LF_CRC_METHOD == LF_CRC_NIBBLE_TABLE
+static const uint32_t sCrcTable[16] = {
+    0x00000000u, 0x1db71064u, 0x3b6e20c8u, 0x26d930acu,
+    0x76dc4190u, 0x6b6b51f4u, 0x4db26158u, 0x5005713cu,
+    0xedb88320u, 0xf00f9344u, 0xd6d6a3e8u, 0xcb61b38cu,
+    0x9b64c2b0u, 0x86d3d2d4u, 0xa00ae278u, 0xbdbdf21cu
+};
+#elif LF_CRC_METHOD == LF_CRC_BYTE_TABLE
+static const uint32_t sCrcTable[256] = {
+    0x00000000u, 0x77073096u, 0xee0e612cu, 0x990951bau, 0x076dc419u, 0x706af48fu,
+    0xe963a535u, 0x9e6495a3u, 0x0edb8832u, 0x79dcb8a4u, 0xe0d5e91eu, 0x97d2d988u,
+    0x09b64c2bu, 0x7eb17cbdu, 0xe7b82d07u, 0x90bf1d91u, 0x1db71064u, 0x6ab020f2u,
+    0xf3b97148u, 0x84be41deu, 0x1adad47du, 0x6ddde4ebu, 0xf4d4b551u, 0x83d385c7u,
+    0x136c9856u, 0x646ba8c0u, 0xfd62f97au, 0x8a65c9ecu, 0x14015c4fu, 0x63066cd9u,
+    0xfa0f3d63u, 0x8d080df5u, 0x3b6e20c8u, 0x4c69105eu, 0xd56041e4u, 0xa2677172u,
+    0x3c03e4d1u, 0x4b04d447u, 0xd20d85fdu, 0xa50ab56bu, 0x35b5a8fau, 0x42b2986cu,
+    0xdbbbc9d6u, 0xacbcf940u, 0x32d86ce3u, 0x45df5c75u, 0xdcd60dcfu, 0xabd13d59u,
+    0x26d930acu, 0x51de003au, 0xc8d75180u, 0xbfd06116u, 0x21b4f4b5u, 0x56b3c423u,
+    0xcfba9599u, 0xb8bda50fu, 0x2802b89eu, 0x5f058808u, 0xc60cd9b2u, 0xb10be924u,
+    0x2f6f7c87u, 0x58684c11u, 0xc1611dabu, 0xb6662d3du, 0x76dc4190u, 0x01db7106u,
+    0x98d220bcu, 0xefd5102au, 0x71b18589u, 0x06b6b51fu, 0x9fbfe4a5u, 0xe8b8d433u,
+    0x7807c9a2u, 0x0f00f934u, 0x9609a88eu, 0xe10e9818u, 0x7f6a0dbbu, 0x086d3d2du,
+    0x91646c97u, 0xe6635c01u, 0x6b6b51f4u, 0x1c6c6162u, 0x856530d8u, 0xf262004eu,
+    0x6c0695edu, 0x1b01a57bu, 0x8208f4c1u, 0xf50fc457u, 0x65b0d9c6u, 0x12b7e950u,
+    0x8bbeb8eau, 0xfcb9887cu, 0x62dd1ddfu, 0x15da2d49u, 0x8cd37cf3u, 0xfbd44c65u,
+    0x4db26158u, 0x3ab551ceu, 0xa3bc0074u, 0xd4bb30e2u, 0x4adfa541u, 0x3dd895d7u,
+    0xa4d1c46du, 0xd3d6f4fbu, 0x4369e96au, 0x346ed9fcu, 0xad678846u, 0xda60b8d0u,
+    0x44042d73u, 0x33031de5u, 0xaa0a4c5fu, 0xdd0d7cc9u, 0x5005713cu, 0x270241aau,
+    0xbe0b1010u, 0xc90c2086u, 0x5768b525u, 0x206f85b3u, 0xb966d409u, 0xce61e49fu,
+    0x5edef90eu, 0x29d9c998u, 0xb0d09822u, 0xc7d7a8b4u, 0x59b33d17u, 0x2eb40d81u,
+    0xb7bd5c3bu, 0xc0ba6cadu, 0xedb88320u, 0x9abfb3b6u, 0x03b6e20cu, 0x74b1d29au,
+    0xead54739u, 0x9dd277afu, 0x04db2615u, 0x73dc1683u, 0xe3630b12u, 0x94643b84u,
+    0x0d6d6a3eu, 0x7a6a5aa8u, 0xe40ecf0bu, 0x9309ff9du, 0x0a00ae27u, 0x7d079eb1u,
+    0xf00f9344u, 0x8708a3d2u, 0x1e01f268u, 0x6906c2feu, 0xf762575du, 0x806567cbu,
+    0x196c3671u, 0x6e6b06e7u, 0xfed41b76u, 0x89d32be0u, 0x10da7a5au, 0x67dd4accu,
+    0xf9b9df6fu, 0x8ebeeff9u, 0x17b7be43u, 0x60b08ed5u, 0xd6d6a3e8u, 0xa1d1937eu,
+    0x38d8c2c4u, 0x4fdff252u, 0xd1bb67f1u, 0xa6bc5767u, 0x3fb506ddu, 0x48b2364bu,
+    0xd80d2bdau, 0xaf0a1b4cu, 0x36034af6u, 0x41047a60u, 0xdf60efc3u, 0xa867df55u,
+    0x316e8eefu, 0x4669be79u, 0xcb61b38cu, 0xbc66831au, 0x256fd2a0u, 0x5268e236u,
+    0xcc0c7795u, 0xbb0b4703u, 0x220216b9u, 0x5505262fu, 0xc5ba3bbeu, 0xb2bd0b28u,
+    0x2bb45a92u, 0x5cb36a04u, 0xc2d7ffa7u, 0xb5d0cf31u, 0x2cd99e8bu, 0x5bdeae1du,
+    0x9b64c2b0u, 0xec63f226u, 0x756aa39cu, 0x026d930au, 0x9c0906a9u, 0xeb0e363fu,
+    0x72076785u, 0x05005713u, 0x95bf4a82u, 0xe2b87a14u, 0x7bb12baeu, 0x0cb61b38u,
+    0x92d28e9bu, 0xe5d5be0du, 0x7cdcefb7u, 0x0bdbdf21u, 0x86d3d2d4u, 0xf1d4e242u,
+    0x68ddb3f8u, 0x1fda836eu, 0x81be16cdu, 0xf6b9265bu, 0x6fb077e1u, 0x18b74777u,
+    0x88085ae6u, 0xff0f6a70u, 0x66063bcau, 0x11010b5cu, 0x8f659effu, 0xf862ae69u,
+    0x616bffd3u, 0x166ccf45u, 0xa00ae278u, 0xd70dd2eeu, 0x4e048354u, 0x3903b3c2u,
+    0xa7672661u, 0xd06016f7u, 0x4969474du, 0x3e6e77dbu, 0xaed16a4au, 0xd9d65adcu,
+    0x40df0b66u, 0x37d83bf0u, 0xa9bcae53u, 0xdebb9ec5u, 0x47b2cf7fu, 0x30b5ffe9u,
+    0xbdbdf21cu, 0xcabac28au, 0x53b39330u, 0x24b4a3a6u, 0xbad03605u, 0xcdd70693u,
+    0x54de5729u, 0x23d967bfu, 0xb3667a2eu, 0xc4614ab8u, 0x5d681b02u, 0x2a6f2b94u,
+    0xb40bbe37u, 0xc30c8ea1u, 0x5a05df1bu, 0x2d02ef8du
+};
+#elif LF_CRC_METHOD == LF_CRC_SLICE_BY_4
+#if LF_USE_WORKSPACE
+LF_STATE uint32_t (*sCrcTable)[256]; // in the workspace, NULL if there is no room for it
+#else
+LF_STATE uint32_t sCrcTable[4][256];
+#endif
+
+static void crc_init(void)
+{
+#if LF_USE_WORKSPACE
+    if(sCrcTable == NULL)
+    {
+        return;
+    }
+#endif
+    for(uint16_t i = 0; i < 256; ++i)
     {
-        if(sBlock != sLastFreeBlock)
+        uint32_t crc = i;
+        for(uint8_t bit = 0; bit < 8; ++bit)
         {
-            uint8_t info;
-            result = lf_app_read(sBlock, 0, &info, 1);
-            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xedb88320u) : (crc >> 1);
+        }
+        sCrcTable[0][i] = crc;
+    }
+    for(uint16_t i = 0; i < 256; ++i)
+    {
+        for(uint8_t slice = 1; slice < 4; ++slice)
+        {
+            uint32_t crc = sCrcTable[slice - 1][i];
+            sCrcTable[slice][i] = (crc >> 8) ^ sCrcTable[0][crc & 0xff];
+        }
+    }
+}
+#endif
 
-            if(info == LF_KEY_FREE)
+// continues the CRC-32 'crc' of the previous data (0 for the beginning)
+static uint32_t crc32(uint32_t crc, const void *data, size_t length)
+{
+#if LF_CRC_METHOD == LF_CRC_DRIVER
+    return lf_app_crc32(crc, data, length);
+#else
+    const uint8_t *p = (const uint8_t*)data;
+    crc = ~crc;
+#if LF_CRC_METHOD == LF_CRC_SLICE_BY_4 && LF_USE_WORKSPACE
+    if(sCrcTable == NULL)
+    {
+        while(length-- > 0)
+        {
+            crc ^= *p++;
+            for(uint8_t bit = 0; bit < 8; ++bit)
             {
-                *freeBlock = sLastFreeBlock = sBlock;
-                break;
+                crc = (crc & 1) ? ((crc >> 1) ^ 0xedb88320u) : (crc >> 1);
             }
         }
+        return ~crc;
+    }
+#endif
+#if LF_CRC_METHOD == LF_CRC_SLICE_BY_4
+    while(length >= 4)
+    {
+        crc ^= (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        crc = sCrcTable[3][crc & 0xff] ^ sCrcTable[2][(crc >> 8) & 0xff] ^ sCrcTable[1][(crc >> 16) & 0xff] ^ sCrcTable[0][crc >> 24];
+        p += 4;
+        length -= 4;
+    }
+#endif
+    while(length-- > 0)
+    {
+#if LF_CRC_METHOD == LF_CRC_NIBBLE_TABLE
+        crc ^= *p++;
+        crc = (crc >> 4) ^ sCrcTable[crc & 0x0f];
+        crc = (crc >> 4) ^ sCrcTable[crc & 0x0f];
+#elif LF_CRC_METHOD == LF_CRC_BYTE_TABLE
+        crc = (crc >> 8) ^ sCrcTable[(crc ^ *p++) & 0xff];
+#else
+        crc = (crc >> 8) ^ sCrcTable[0][(crc ^ *p++) & 0xff];
+#endif
+    }
+    return ~crc;
+#endif
+}
 
-        // increment
-        blockIncrement();
+// CRC of the block, the data is followed by the next block and the size
+static uint32_t crc_block(uint32_t crc, uint16_t nextBlock, uint16_t size)
+{
+    uint16_t link[2] = {nextBlock, size};
+    return crc32(crc, link, sizeof(link));
+}
+#endif
+
+// driver calls
+#if LF_USE_BAD_BLOCKS
+static uint8_t is_bad(uint16_t block)
+{
+    for(uint16_t i = 0; i < sBad.count; ++i)
+    {
+        if(sBad.entries[i].block == block)
+        {
+            return 1;
+        }
     }
-    while(sBlock != startBlock);
+    return 0;
+}
 
-    return result;
+// returns the block holding the data of the block, which differs if the block was retired
+static uint16_t remap(uint16_t block)
+{
+    // a replacement can be retired as well
+    for(uint16_t i = 0; i < sBad.count; ++i)
+    {
+        if(sBad.entries[i].block == block && sBad.entries[i].replacement != LF_BLOCK_NONE)
+        {
+            block = sBad.entries[i].replacement;
+            i = (uint16_t)-1;
+        }
+    }
+    return block;
 }
+#endif
 
-static lf_result_t findBlock(block_info_t *info, uint8_t key, uint8_t cacheAll)
+static lf_result_t app_read(uint16_t block, uint16_t offset, void *buffer, size_t length)
+{
+    LF_STATS_ADD(reads, 1);
+    LF_STATS_ADD(bytesRead, length);
+#if LF_USE_BAD_BLOCKS
+    block = remap(block);
+#endif
+    return lf_app_read(block, offset, buffer, length);
+}
+
+static uint16_t blockIncrement(uint16_t block)
+{
+    return (block >= LF_MEMORY_BLOCK_COUNT - 1) ? 0 : (block + 1);
+}
+
+// the blocks of the written file look free until their headers are programmed, called with the lock held
+static uint8_t is_written_block(uint16_t block)
+{
+    if(sEditMode != LF_MODE_WRITING)
+    {
+        return 0;
+    }
+#if LF_USE_BAD_BLOCKS
+    // as well as the replacements of the written blocks
+    return block == remap(sWritten.current) || block == remap(sWritten.next);
+#else
+    return block == sWritten.current || block == sWritten.next;
+#endif
+}
+
+static lf_result_t findFreeBlock(uint16_t *freeBlock)
 {
     lf_result_t result;
 
-    info->block = LF_BLOCK_NONE;
+    *freeBlock = LF_BLOCK_NONE;
     uint16_t startBlock = sBlock;
+    LF_STATS_ADD(allocations, 1);
+#if LF_USE_STRIPING
+    // consecutive allocations alternate the devices, a block of another device
+    // is taken only if the wanted one has no free block
+    uint8_t device = (sLastFreeBlock == LF_BLOCK_NONE) ? 0 : (uint8_t)LF_STRIPE_DEVICE(sLastFreeBlock + 1u, LF_MEMORY_DEVICE_COUNT);
+    uint16_t otherBlock = LF_BLOCK_NONE;
+#endif
 
     do
     {
-        uint8_t header[LF_BLOCK_HEADER_SIZE];
-        result = lf_app_read(sBlock, 0, header, cacheAll ? LF_BLOCK_HEADER_SIZE : 1);
-        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-
-        if( (header[0] & LF_INFO_LEADING_MASK) && ((header[0] & ~LF_INFO_LEADING_MASK) == key) )
+        if(sBlock != sLastFreeBlock && !is_written_block(sBlock) && !LF_IS_BAD(sBlock))
         {
-            info->block = sBlock;
-            if(cacheAll)
+            LF_STATS_ADD(allocationProbes, 1);
+            uint8_t info;
+            result = app_read(sBlock, 0, &info, 1);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+            if(info == LF_KEY_FREE)
             {
-                info->nextBlock = *((uint16_t*)(header+1));
-                info->size = *((uint16_t*)(header+3));
+#if LF_USE_STRIPING
+                if(LF_STRIPE_DEVICE(sBlock, LF_MEMORY_DEVICE_COUNT) != device)
+                {
+                    otherBlock = (otherBlock == LF_BLOCK_NONE) ? sBlock : otherBlock;
+                }
+                else
+#endif
+                {
+                    *freeBlock = sLastFreeBlock = sBlock;
+                    break;
+                }
             }
-            break;
         }
 
         // increment
-        blockIncrement();
+        sBlock = blockIncrement(sBlock);
     }
     while(sBlock != startBlock);
 
+#if LF_USE_STRIPING
+    if(*freeBlock == LF_BLOCK_NONE && otherBlock != LF_BLOCK_NONE)
+    {
+        *freeBlock = sLastFreeBlock = sBlock = otherBlock;
+    }
+#endif
+
     return result;
 }
 
-static lf_result_t save_current_block()
+#if LF_USE_KV || LF_USE_TRANSACTIONS || LF_USE_BAD_BLOCKS
+// searches for a free block under the lock
+static lf_result_t allocateBlock(uint16_t *freeBlock)
 {
-    // update current block header
-    uint8_t header[LF_BLOCK_HEADER_SIZE];
-    *((uint8_t*)(header)) = (sCurrentBlock == sFirstBlock) ? (sKey | LF_INFO_LEADING_MASK) : sKey;
-    *((uint16_t*)(header+1)) = sNextBlock;
-    *((uint16_t*)(header+3)) = sCursor;
-    return lf_app_write(sCurrentBlock, 0, header, LF_BLOCK_HEADER_SIZE, 1);
+    LF_LOCK();
+    lf_result_t result = findFreeBlock(freeBlock);
+    LF_UNLOCK();
+    return result;
 }
+#endif
 
-lf_result_t lf_init(void)
+// allocates the block following the block 'current' of the written file, both are kept
+// from the other allocations until their headers are programmed
+static lf_result_t allocate_written(uint16_t *freeBlock, uint16_t current)
 {
-    sBlock = 0;
-    sFirstBlock = LF_BLOCK_NONE;
-    sCurrentBlock = LF_BLOCK_NONE;
-    sNextBlock = LF_BLOCK_NONE;
-    sCursor = 0;
-    sSize = 0;
-    sKey = LF_KEY_FREE;
-    sEditMode = LF_MODE_NONE;
-    sBlock = 0;
-    sLastFreeBlock = LF_BLOCK_NONE;
-
-    lf_result_t result = lf_app_init(&sMemory);
+    LF_LOCK();
+    lf_result_t result = findFreeBlock(freeBlock);
+    sWritten.current = current;
+    sWritten.next = *freeBlock;
+    LF_UNLOCK();
     LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-    LF_ASSERT(sMemory.blockSize <= LF_BLOCK_HEADER_SIZE || sMemory.blockCount == 0 || sMemory.blockCount == 0xffff, LF_RESULT_INVALID_CONFIG);
+    LF_ASSERT(*freeBlock == LF_BLOCK_NONE, LF_RESULT_OUT_OF_MEMORY);
     return result;
 }
 
-lf_result_t lf_exists(uint8_t key)
+#if LF_USE_BAD_BLOCKS
+// programs the block itself, never crossing a program page
+static lf_result_t program_block(uint16_t block, uint16_t offset, const void *data, size_t length)
 {
-    LF_ASSERT(key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+    lf_result_t result = LF_RESULT_SUCCESS;
+    const uint8_t *content = (const uint8_t*)data;
 
-    block_info_t info;
-    lf_result_t result = findBlock(&info, key, 0);
-    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-    if(info.block == LF_BLOCK_NONE)
+    while(length > 0)
     {
-        result = LF_RESULT_NOT_EXISTS;
+        size_t toSaveSize = length;
+        if(LF_MEMORY_PAGE_SIZE != 0 && (offset % LF_MEMORY_PAGE_SIZE) + toSaveSize > LF_MEMORY_PAGE_SIZE)
+        {
+            toSaveSize = LF_MEMORY_PAGE_SIZE - (offset % LF_MEMORY_PAGE_SIZE);
+        }
+        LF_STATS_ADD(writes, 1);
+        LF_STATS_ADD(bytesWritten, toSaveSize);
+        result = lf_app_write(block, offset, (void*)content, toSaveSize, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+        offset += toSaveSize;
+        content += toSaveSize;
+        length -= toSaveSize;
     }
 
-    return result; 
+    return result;
 }
 
-// open for write
-lf_result_t lf_create(uint8_t key)
+// adds an entry to the table in RAM, called with the lock held
+static lf_result_t add_bad_block(uint16_t block, uint16_t replacement)
 {
-    // validate state
-    LF_ASSERT(sEditMode != LF_MODE_NONE, LF_RESULT_INVALID_STATE);
+    LF_ASSERT(sBad.count >= LF_BAD_BLOCKS_MAX || LF_BLOCK_HEADER_SIZE + (sBad.count + 1) * LF_BAD_BLOCK_ENTRY_SIZE > LF_MEMORY_BLOCK_SIZE, LF_RESULT_OUT_OF_MEMORY);
+    sBad.entries[sBad.count].block = block;
+    sBad.entries[sBad.count].replacement = replacement;
+    ++sBad.count;
+    LF_STATS_ADD(blocksRetired, 1);
+    return LF_RESULT_SUCCESS;
+}
 
-    // validate args
-    LF_ASSERT(key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+// programs the entries missing in the table block, the table is moved to a new block if its block fails
+static lf_result_t save_bad_blocks(void)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
 
-    block_info_t info;
-    lf_result_t result = findBlock(&info, key, 0);
-    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-    LF_ASSERT(info.block != LF_BLOCK_NONE, LF_RESULT_ALREADY_EXISTS);
-        
-    result = findFreeBlock(&info.block);
-    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-    LF_ASSERT(info.block == LF_BLOCK_NONE, LF_RESULT_OUT_OF_MEMORY);
+    while(sBad.saved < sBad.count)
+    {
+        uint16_t index = sBad.saved;
+        uint16_t block = sBad.tableBlock;
+        if(block == LF_BLOCK_NONE)
+        {
+            result = allocateBlock(&block);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            LF_ASSERT(block == LF_BLOCK_NONE, LF_RESULT_OUT_OF_MEMORY);
 
-    sFirstBlock = info.block;
-    sCurrentBlock = info.block;
-    sCursor = 0;
-    sSize = 0;
-    sKey = key;
-    sEditMode = LF_MODE_WRITING;
+            // a block of a rewritable memory keeps its old data, the entries are cleared first
+            // so the table ends after the last programmed one
+            uint8_t erased[LF_STACK_BUFFER_SIZE];
+            memset(erased, 0xff, sizeof(erased));
+            for(uint16_t offset = LF_BLOCK_LINK_SIZE; LF_MEMORY_REWRITABLE && offset < LF_MEMORY_BLOCK_SIZE && result == LF_RESULT_SUCCESS; offset += LF_STACK_BUFFER_SIZE)
+            {
+                size_t length = (LF_MEMORY_BLOCK_SIZE - offset > LF_STACK_BUFFER_SIZE) ? LF_STACK_BUFFER_SIZE : (LF_MEMORY_BLOCK_SIZE - offset);
+                result = program_block(block, offset, erased, length);
+            }
+
+            uint8_t header[LF_BLOCK_LINK_SIZE];
+            header[0] = LF_INFO_SYSTEM;
+            *((uint16_t*)(header+1)) = LF_BLOCK_NONE;
+            *((uint16_t*)(header+3)) = LF_SYSTEM_BAD_BLOCKS;
+            if(result == LF_RESULT_SUCCESS)
+            {
+                result = program_block(block, 0, header, sizeof(header));
+            }
+            if(result == LF_RESULT_SUCCESS)
+            {
+                sBad.tableBlock = block;
+                sBad.saved = 0;
+                continue;
+            }
+        }
+        else
+        {
+            result = program_block(block, LF_BLOCK_HEADER_SIZE + index * LF_BAD_BLOCK_ENTRY_SIZE, &sBad.entries[index], LF_BAD_BLOCK_ENTRY_SIZE);
+            if(result == LF_RESULT_SUCCESS)
+            {
+                // another thread retiring a block may have programmed the same entry
+                LF_LOCK();
+                if(sBad.saved == index)
+                {
+                    ++sBad.saved;
+                }
+                LF_UNLOCK();
+                continue;
+            }
+        }
+        LF_ASSERT(result != LF_RESULT_BAD_BLOCK, result);
+
+        // all the entries are programmed to a new table block
+        LF_LOCK();
+        result = add_bad_block(block, LF_BLOCK_NONE);
+        LF_UNLOCK();
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        sBad.tableBlock = LF_BLOCK_NONE;
+    }
 
     return result;
 }
 
-lf_result_t lf_write(void *content, size_t length)
+// adds the block to the table and saves it
+static lf_result_t retire_block(uint16_t block, uint16_t replacement)
 {
-    // validate state
-    LF_ASSERT(sEditMode != LF_MODE_WRITING, LF_RESULT_INVALID_STATE);
-
-    if(length == 0)
-    {
-        return LF_RESULT_SUCCESS;
-    }
-
-    lf_result_t result = LF_RESULT_SUCCESS;
-    size_t contentOffset = 0;
+    LF_LOCK();
+    lf_result_t result = add_bad_block(block, replacement);
+    LF_UNLOCK();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    return save_bad_blocks();
+}
 
+// copies the programmed data of the failed block to a free block, which replaces it
+static lf_result_t replace_block(uint16_t block)
+{
     while(1)
     {
-        size_t spaceLeft = sMemory.blockSize - sCursor - LF_BLOCK_HEADER_SIZE;
-        if(spaceLeft == 0)
+        uint16_t replacement;
+        lf_result_t result = allocateBlock(&replacement);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        LF_ASSERT(replacement == LF_BLOCK_NONE, LF_RESULT_OUT_OF_MEMORY);
+
+        // the erased parts are skipped, they can be programmed later
+        for(uint16_t offset = 0; offset < LF_MEMORY_BLOCK_SIZE && result == LF_RESULT_SUCCESS; offset += LF_STACK_BUFFER_SIZE)
         {
-            // find new block
-            block_info_t info;
-            result = findFreeBlock(&info.block);
+            uint8_t buffer[LF_STACK_BUFFER_SIZE];
+            size_t length = (LF_MEMORY_BLOCK_SIZE - offset > LF_STACK_BUFFER_SIZE) ? LF_STACK_BUFFER_SIZE : (LF_MEMORY_BLOCK_SIZE - offset);
+            result = app_read(block, offset, buffer, length);
             LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-            LF_ASSERT(info.block == LF_BLOCK_NONE, LF_RESULT_OUT_OF_MEMORY);
+            for(size_t i = 0; i < length; ++i)
+            {
+                if(buffer[i] != 0xff)
+                {
+                    result = program_block(replacement, offset, buffer, length);
+                    break;
+                }
+            }
+        }
 
-            // update current block header
-            sNextBlock = info.block;
-            result = save_current_block();
+        if(result == LF_RESULT_SUCCESS)
+        {
+            result = retire_block(block, replacement);
             LF_ASSERT(result != LF_RESULT_SUCCESS, result);
 
-            // switch to the new block
-            sCurrentBlock = info.block;
-            sCursor = 0;
-
-            spaceLeft = sMemory.blockSize - LF_BLOCK_HEADER_SIZE;
+            // the replacement of a block which is still written may look free
+            LF_LOCK();
+            sLastFreeBlock = replacement;
+            LF_UNLOCK();
+            return result;
         }
+        LF_ASSERT(result != LF_RESULT_BAD_BLOCK, result);
 
-        size_t toSaveSize = (length > spaceLeft) ? spaceLeft : length;
-        result = lf_app_write(sCurrentBlock, LF_BLOCK_HEADER_SIZE + sCursor, (uint8_t*)content + contentOffset, toSaveSize, 0);
+        // the replacement failed as well
+        result = retire_block(replacement, LF_BLOCK_NONE);
         LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-        sCursor += toSaveSize;
+    }
+}
 
-        // if thats all
-        if(toSaveSize == length)
+// builds the table from the table blocks in the memory
+static lf_result_t load_bad_blocks(void)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    uint16_t tableEntries = 0;
+
+    sBad.tableBlock = LF_BLOCK_NONE;
+    sBad.count = 0;
+    for(uint16_t block = 0; block < LF_MEMORY_BLOCK_COUNT; ++block)
+    {
+        // the blocks are read as they are, the table is not complete yet
+        uint8_t header[LF_BLOCK_LINK_SIZE];
+        result = lf_app_read(block, 0, header, sizeof(header));
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(header[0] != LF_INFO_SYSTEM || (header[3] | (header[4] << 8)) != LF_SYSTEM_BAD_BLOCKS)
         {
-            break;
+            continue;
+        }
+
+        uint16_t entries = 0;
+        for(uint16_t offset = LF_BLOCK_HEADER_SIZE; offset + LF_BAD_BLOCK_ENTRY_SIZE <= LF_MEMORY_BLOCK_SIZE; offset += LF_BAD_BLOCK_ENTRY_SIZE)
+        {
+            bad_block_t entry;
+            result = lf_app_read(block, offset, &entry, LF_BAD_BLOCK_ENTRY_SIZE);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            if(entry.block == LF_BLOCK_NONE)
+            {
+                break;
+            }
+            ++entries;
+            if(!is_bad(entry.block) && sBad.count < LF_BAD_BLOCKS_MAX)
+            {
+                sBad.entries[sBad.count++] = entry;
+            }
+        }
+
+        // the table moved from a failed block is newer
+        if(sBad.tableBlock == LF_BLOCK_NONE || is_bad(sBad.tableBlock))
+        {
+            sBad.tableBlock = block;
+            tableEntries = entries;
         }
-        
-        contentOffset += toSaveSize;
-        length -= toSaveSize;
     }
 
+    // if the tables differ, the merged one is written to a new block on the next retirement
+    if(sBad.tableBlock != LF_BLOCK_NONE && (is_bad(sBad.tableBlock) || tableEntries != sBad.count))
+    {
+        sBad.tableBlock = LF_BLOCK_NONE;
+    }
+    sBad.saved = (sBad.tableBlock == LF_BLOCK_NONE) ? 0 : sBad.count;
     return result;
 }
+#endif
 
-lf_result_t lf_save(void)
+static lf_result_t app_write(uint16_t block, uint16_t offset, void *buffer, size_t length, uint8_t flush)
 {
-    // validate state
-    if(sEditMode != LF_MODE_WRITING)
+#if LF_USE_BAD_BLOCKS
+    while(1)
     {
-        return LF_RESULT_INVALID_STATE;
+        uint16_t physical = remap(block);
+        LF_STATS_ADD(writes, 1);
+        LF_STATS_ADD(bytesWritten, length);
+        lf_result_t result = lf_app_write(physical, offset, buffer, length, flush);
+        LF_ASSERT(result != LF_RESULT_BAD_BLOCK, result);
+
+        // the write is retried on the replacement
+        result = replace_block(physical);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
     }
+#else
+    LF_STATS_ADD(writes, 1);
+    LF_STATS_ADD(bytesWritten, length);
+    return lf_app_write(block, offset, buffer, length, flush);
+#endif
+}
 
-    // update current block header
-    sNextBlock = LF_BLOCK_NONE;
-    lf_result_t result = save_current_block();
-    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-    sEditMode = LF_MODE_NONE;
+#if LF_USE_ERASE_RANGE
+static lf_result_t app_erase_range(uint16_t block, uint16_t count)
+{
+#if LF_USE_BAD_BLOCKS
+    uint8_t retired = 0;
+    for(uint16_t i = 0; i < count; ++i)
+    {
+        retired |= is_bad(block + i);
+    }
+    if(!retired)
+    {
+        LF_STATS_ADD(erases, 1);
+        LF_STATS_ADD(blocksErased, count);
+        lf_result_t result = lf_app_erase_range(block, count);
+        LF_ASSERT(result != LF_RESULT_BAD_BLOCK, result);
+    }
+
+    // the blocks are erased one by one to find the failed ones, the replacements instead of the retired ones
+    lf_result_t result = LF_RESULT_SUCCESS;
+    for(uint16_t i = 0; i < count; ++i)
+    {
+        uint16_t physical = remap(block + i);
+        if(!is_bad(physical))
+        {
+            LF_STATS_ADD(erases, 1);
+            LF_STATS_ADD(blocksErased, 1);
+            result = lf_app_erase_range(physical, 1);
+            if(result == LF_RESULT_BAD_BLOCK)
+            {
+                // the rest is erased first, a new table block can be allocated from the erased blocks
+                result = app_erase_range(block + i + 1, count - i - 1);
+                LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+                return retire_block(physical, LF_BLOCK_NONE);
+            }
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+    }
+    return result;
+#else
+    LF_STATS_ADD(erases, 1);
+    LF_STATS_ADD(blocksErased, count);
+    return lf_app_erase_range(block, count);
+#endif
+}
+#else
+static lf_result_t app_delete(uint16_t block)
+{
+#if LF_USE_BAD_BLOCKS
+    // a retired block is not erased anymore
+    block = remap(block);
+    if(is_bad(block))
+    {
+        return LF_RESULT_SUCCESS;
+    }
+#endif
+    LF_STATS_ADD(erases, 1);
+    LF_STATS_ADD(blocksErased, 1);
+    lf_result_t result = lf_app_delete(block);
+#if LF_USE_BAD_BLOCKS
+    if(result == LF_RESULT_BAD_BLOCK)
+    {
+        result = retire_block(block, LF_BLOCK_NONE);
+    }
+#endif
+    return result;
+}
+#endif
 
+#if LF_USE_TRANSACTIONS
+// checks if the file is a new version written in a transaction which is not committed yet
+static lf_result_t is_pending(uint16_t block, uint8_t *pending)
+{
+    uint8_t flags;
+    lf_result_t result = app_read(block, LF_BLOCK_HEADER_SIZE, &flags, 1);
+    flags = ~flags;
+    *pending = (flags & LF_FILE_FLAG_PENDING) && !(flags & LF_FILE_FLAG_COMMITTED);
     return result;
 }
+#endif
 
-// open for read
-lf_result_t lf_open(uint8_t key)
+// finds the leading block of the file, or of its pending version (transactions only)
+static lf_result_t findVersion(block_info_t *info, uint8_t key, uint8_t cacheAll, uint8_t pending)
 {
-    // validate state
-    LF_ASSERT(sEditMode != LF_MODE_NONE, LF_RESULT_INVALID_STATE);
+    lf_result_t result;
 
-    // validate key
-    LF_ASSERT(key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+    info->block = LF_BLOCK_NONE;
+    LF_STATS_ADD(lookups, 1);
 
-    block_info_t info;
-    lf_result_t result = findBlock(&info, key, 1);
-    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-    LF_ASSERT(info.block == LF_BLOCK_NONE, LF_RESULT_NOT_EXISTS);
-    
-    sFirstBlock = info.block;
-    sCurrentBlock = info.block;
-    sNextBlock = info.nextBlock;
-    sCursor = 0;
-    sSize = info.size;
-    sKey = key;
-    sEditMode = LF_MODE_READING;
+    // the search starts where the previous one ended, the blocks are read without the lock
+    LF_LOCK();
+    uint16_t block = sBlock;
+    LF_UNLOCK();
+    uint16_t startBlock = block;
+
+    do
+    {
+        if(LF_IS_BAD(block))
+        {
+            block = blockIncrement(block);
+            continue;
+        }
+        LF_STATS_ADD(lookupProbes, 1);
+        uint8_t header[LF_BLOCK_LINK_SIZE];
+        result = app_read(block, 0, header, cacheAll ? LF_BLOCK_LINK_SIZE : 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+        uint8_t found = (header[0] & LF_INFO_LEADING_MASK) && ((header[0] & ~LF_INFO_LEADING_MASK) == key);
+#if LF_USE_TRANSACTIONS
+        if(found)
+        {
+            uint8_t isPending;
+            result = is_pending(block, &isPending);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            found = (isPending == pending);
+        }
+#else
+        (void)pending;
+#endif
+        if(found)
+        {
+            info->block = block;
+            if(cacheAll)
+            {
+                info->nextBlock = *((uint16_t*)(header+1));
+                info->size = *((uint16_t*)(header+3));
+            }
+            LF_LOCK();
+            sBlock = block;
+            LF_UNLOCK();
+            break;
+        }
+
+        // increment
+        block = blockIncrement(block);
+    }
+    while(block != startBlock);
 
     return result;
 }
 
-lf_result_t lf_read(void *content, size_t length)
+static lf_result_t findBlock(block_info_t *info, uint8_t key, uint8_t cacheAll)
 {
-    // validate state
-    LF_ASSERT(sEditMode != LF_MODE_READING, LF_RESULT_INVALID_STATE);
+    return findVersion(info, key, cacheAll, 0);
+}
 
-    if(length == 0)
+// writes content to the current block at the cursor, never crossing a program page
+static lf_result_t write_current_block(uint8_t *content, size_t length)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    uint16_t dataOffset = LF_DATA_OFFSET(sCurrentBlock == sFirstBlock);
+    uint16_t offset = dataOffset + sCursor;
+
+#if LF_USE_CRC
+    sCrc = crc32(sCrc, content, length);
+#endif
+
+    if(LF_MEMORY_PAGE_SIZE == 0)
     {
-        return LF_RESULT_SUCCESS;
+        return app_write(sCurrentBlock, offset, content, length, 0);
     }
 
-    lf_result_t result = LF_RESULT_SUCCESS;
-    size_t contentOffset = 0;
-
-    while(1)
+    while(length > 0)
     {
-        // check if current block contains enough data
-        size_t dataLeftSize;
-        while(1)
+        uint16_t pageOffset = offset % LF_MEMORY_PAGE_SIZE;
+        size_t toSaveSize = LF_MEMORY_PAGE_SIZE - pageOffset;
+        if(toSaveSize > length)
         {
-            dataLeftSize = sSize - sCursor;
-            if(dataLeftSize == 0)
-            {
-                if(sNextBlock == LF_BLOCK_NONE)
-                {
-                    return LF_RESULT_END_OF_FILE;
-                }
-                else
-                {
-                    // cache next block
-                    uint8_t header[LF_BLOCK_HEADER_SIZE - 1];
-                    result = lf_app_read(sNextBlock, 1, header, 4);
-                    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-                    sCurrentBlock = sNextBlock;
-                    sNextBlock = *((uint16_t*)(header));
-                    sCursor = 0;
-                    sSize = *((uint16_t*)(header+2));
-                    dataLeftSize = sSize - sCursor;
-                }
-            }
-            else
-            {
-                break;
-            }
+            toSaveSize = length;
         }
 
-        size_t toReadSize = (length > dataLeftSize) ? dataLeftSize : length;
-        if(content != NULL)
+#if LF_PAGE_BUFFER_SIZE > 0
+        if(offset == dataOffset)
         {
-            result = lf_app_read(sCurrentBlock, LF_BLOCK_HEADER_SIZE + sCursor, (uint8_t*)content + contentOffset, toReadSize);
-            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            // header is programmed separately, keep it erased
+            memset(sPageBuffer, 0xff, pageOffset);
         }
-        sCursor += toReadSize;
-
-        // if thats all
-        if(toReadSize == length)
+        memcpy(sPageBuffer + pageOffset, content, toSaveSize);
+        if(pageOffset + toSaveSize == LF_MEMORY_PAGE_SIZE)
         {
-            break;
+            result = app_write(sCurrentBlock, offset - pageOffset, sPageBuffer, LF_MEMORY_PAGE_SIZE, 0);
         }
+#else
+        result = app_write(sCurrentBlock, offset, content, toSaveSize, 0);
+#endif
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
 
-        contentOffset += toReadSize;
-        length -= toReadSize;
+        offset += toSaveSize;
+        content += toSaveSize;
+        length -= toSaveSize;
     }
 
     return result;
 }
 
-lf_result_t lf_close(void)
+// programs the partially filled page kept in the page buffer
+static lf_result_t flush_current_block(void)
 {
-    LF_ASSERT(sEditMode != LF_MODE_READING, LF_RESULT_INVALID_STATE);
-    sEditMode = LF_MODE_NONE;
+#if LF_PAGE_BUFFER_SIZE > 0
+    if(LF_MEMORY_PAGE_SIZE != 0 && sCursor != 0)
+    {
+        uint16_t offset = LF_DATA_OFFSET(sCurrentBlock == sFirstBlock) + sCursor;
+        uint16_t pageOffset = offset % LF_MEMORY_PAGE_SIZE;
+        if(pageOffset != 0)
+        {
+            return app_write(sCurrentBlock, offset - pageOffset, sPageBuffer, pageOffset, 0);
+        }
+    }
+#endif
     return LF_RESULT_SUCCESS;
 }
 
-lf_result_t lf_delete(uint8_t key)
+#if LF_USE_TAIL
+// shows the followers the data of the current block programmed so far
+static void publish_tail(void)
 {
-    LF_ASSERT(sEditMode != LF_MODE_NONE, LF_RESULT_INVALID_STATE);
-    LF_ASSERT(key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+    uint16_t flushed = sCursor;
+#if LF_PAGE_BUFFER_SIZE > 0
+    if(LF_MEMORY_PAGE_SIZE != 0)
+    {
+        // the partially filled page is still in the buffer
+        uint16_t buffered = (LF_DATA_OFFSET(sCurrentBlock == sFirstBlock) + sCursor) % LF_MEMORY_PAGE_SIZE;
+        flushed = (buffered > sCursor) ? 0 : sCursor - buffered;
+    }
+#endif
+    LF_LOCK();
+    sTail.block = sCurrentBlock;
+    sTail.flushed = flushed;
+    LF_UNLOCK();
+}
+#endif
 
-    // find block
-    block_info_t info;
-    lf_result_t result = findBlock(&info, key, 1);
+// marks the block as free without erasing it (rewritable memories only)
+static lf_result_t invalidate_block(uint16_t block)
+{
+    uint8_t info = LF_KEY_FREE;
+    return app_write(block, 0, &info, 1, 1);
+}
+
+static lf_result_t save_current_block()
+{
+    lf_result_t result = flush_current_block();
     LF_ASSERT(result != LF_RESULT_SUCCESS, result);
-    LF_ASSERT(info.block == LF_BLOCK_NONE, LF_RESULT_NOT_EXISTS);
-    sCurrentBlock = info.block;
-    sNextBlock = info.nextBlock;
 
-    while(1)
+    // update current block header
+    uint8_t leading = (sCurrentBlock == sFirstBlock);
+    uint8_t header[LF_LEADING_HEADER_SIZE];
+    *((uint8_t*)(header)) = leading ? (sKey | LF_INFO_LEADING_MASK) : sKey;
+    *((uint16_t*)(header+1)) = sNextBlock;
+    *((uint16_t*)(header+3)) = sCursor;
+#if LF_USE_CRC
+    *((uint32_t*)(header+LF_BLOCK_LINK_SIZE)) = crc_block(sCrc, sNextBlock, sCursor);
+#endif
+#if LF_USE_FILE_ATTRIBUTES
+    // the content size is known if the file ends in the leading block
+    *((uint8_t*)(header+LF_BLOCK_HEADER_SIZE)) = (uint8_t)~sFlags;
+    *((uint32_t*)(header+LF_BLOCK_HEADER_SIZE+1)) = (sNextBlock == LF_BLOCK_NONE) ? sContentSize : LF_SIZE_UNKNOWN;
+#endif
+#if LF_USE_RECORDS
+    *((uint16_t*)(header+LF_BLOCK_HEADER_SIZE+5)) = (sRecordSize != 0) ? sRecordSize : LF_RECORD_SIZE_NONE;
+#endif
+    return app_write(sCurrentBlock, 0, header, LF_DATA_OFFSET(leading), 1);
+}
+
+#if LF_USE_WORKSPACE
+static void workspace_sizes(lf_workspace_sizes *sizes)
+{
+    memset(sizes, 0, sizeof(*sizes));
+#if LF_PAGE_BUFFER_SIZE > 0
+    sizes->pageBuffer = LF_WORKSPACE_ALIGN(LF_PAGE_BUFFER_SIZE);
+#endif
+#if LF_USE_KV
+    sizes->kvIndex = LF_WORKSPACE_ALIGN(LF_KV_INDEX_SIZE * sizeof(kv_entry_t));
+#endif
+#if LF_USE_BAD_BLOCKS
+    sizes->badBlocks = LF_WORKSPACE_ALIGN(LF_BAD_BLOCKS_MAX * sizeof(bad_block_t));
+#endif
+#if LF_USE_CRC && LF_CRC_METHOD == LF_CRC_SLICE_BY_4
+    sizes->crcTable = 4 * 256 * sizeof(uint32_t);
+#endif
+    sizes->required = sizes->pageBuffer + sizes->kvIndex + sizes->badBlocks;
+    sizes->total = sizes->required + sizes->crcTable;
+}
+
+// points the buffers to their parts of the workspace, the optional ones last
+static lf_result_t workspace_carve(void)
+{
+    lf_workspace_sizes sizes;
+    workspace_sizes(&sizes);
+    LF_ASSERT(sWorkspace.size < sizes.required, LF_RESULT_OUT_OF_MEMORY);
+
+    uint8_t *part = sWorkspace.ptr;
+#if LF_PAGE_BUFFER_SIZE > 0
+    sPageBuffer = part;
+    part += sizes.pageBuffer;
+#endif
+#if LF_USE_KV
+    sKv.index = (kv_entry_t*)part;
+    part += sizes.kvIndex;
+#endif
+#if LF_USE_BAD_BLOCKS
+    sBad.entries = (bad_block_t*)part;
+    part += sizes.badBlocks;
+#endif
+#if LF_USE_CRC && LF_CRC_METHOD == LF_CRC_SLICE_BY_4
+    sCrcTable = (sWorkspace.size >= sizes.total) ? (uint32_t(*)[256])part : NULL;
+#endif
+    (void)part;
+    return LF_RESULT_SUCCESS;
+}
+#endif
+
+static lf_result_t init_impl(void)
+{
+#if LF_USE_WORKSPACE
+    lf_result_t carved = workspace_carve();
+    LF_ASSERT(carved != LF_RESULT_SUCCESS, carved);
+#endif
+    sBlock = 0;
+    sFirstBlock = LF_BLOCK_NONE;
+    sCurrentBlock = LF_BLOCK_NONE;
+    sNextBlock = LF_BLOCK_NONE;
+    sCursor = 0;
+    sKey = LF_KEY_FREE;
+    sFlags = 0;
+    sContentSize = 0;
+    sEditMode = LF_MODE_NONE;
+#if LF_USE_CRC && LF_CRC_METHOD == LF_CRC_SLICE_BY_4
+    crc_init();
+#endif
+    sReader.open = 0;
+    sReaders = NULL;
+    sDeletedKey = LF_KEY_FREE;
+    sBlock = 0;
+    sLastFreeBlock = LF_BLOCK_NONE;
+#if LF_USE_KV
+    sKv.loaded = 0;
+#endif
+#if LF_USE_TAIL
+    sTail.block = LF_BLOCK_NONE;
+#endif
+
+    sMemory.pageSize = 0;
+    sMemory.flags = 0;
+    sMemory.deviceCount = 1;
+
+    // the driver does not need to set the values fixed at compile time
+#ifdef LF_BLOCK_SIZE
+    sMemory.blockSize = LF_BLOCK_SIZE;
+#endif
+#ifdef LF_BLOCK_COUNT
+    sMemory.blockCount = LF_BLOCK_COUNT;
+#endif
+#ifdef LF_PAGE_SIZE
+    sMemory.pageSize = LF_PAGE_SIZE;
+#endif
+#ifdef LF_MEMORY_FLAGS
+    sMemory.flags = LF_MEMORY_FLAGS;
+#endif
+#ifdef LF_DEVICE_COUNT
+    sMemory.deviceCount = LF_DEVICE_COUNT;
+#endif
+
+    lf_result_t result = lf_app_init(&sMemory);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(sMemory.blockSize != LF_MEMORY_BLOCK_SIZE || sMemory.blockCount != LF_MEMORY_BLOCK_COUNT || sMemory.pageSize != LF_MEMORY_PAGE_SIZE || (sMemory.flags & LF_MEMORY_FLAG_REWRITABLE) != LF_MEMORY_REWRITABLE, LF_RESULT_INVALID_CONFIG);
+    LF_ASSERT(LF_MEMORY_BLOCK_SIZE <= LF_LEADING_HEADER_SIZE || LF_MEMORY_BLOCK_COUNT == 0 || LF_MEMORY_BLOCK_COUNT == 0xffff, LF_RESULT_INVALID_CONFIG);
+    LF_ASSERT(LF_MEMORY_PAGE_SIZE != 0 && (LF_MEMORY_PAGE_SIZE < LF_LEADING_HEADER_SIZE || LF_MEMORY_BLOCK_SIZE % LF_MEMORY_PAGE_SIZE != 0), LF_RESULT_INVALID_CONFIG);
+#if LF_PAGE_BUFFER_SIZE > 0
+    LF_ASSERT(LF_MEMORY_PAGE_SIZE > LF_PAGE_BUFFER_SIZE, LF_RESULT_INVALID_CONFIG);
+#endif
+#if LF_USE_STRIPING
+    LF_ASSERT(sMemory.deviceCount != LF_MEMORY_DEVICE_COUNT || LF_MEMORY_DEVICE_COUNT == 0, LF_RESULT_INVALID_CONFIG);
+#endif
+#if LF_USE_BAD_BLOCKS
+    result = load_bad_blocks();
+#endif
+    return result;
+}
+
+// checks if the key is written or read, called with the lock held
+static uint8_t is_open(uint8_t key)
+{
+    if(sEditMode == LF_MODE_WRITING && sKey == key)
     {
-        // erase block
-        result = lf_app_delete(sCurrentBlock);
-        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        return 1;
+    }
+    for(lf_reader *reader = sReaders; reader != NULL; reader = reader->next)
+    {
+        if(reader->key == key)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// adds the reader to the open ones, called with the lock held
+static lf_result_t add_reader(lf_reader *reader, uint8_t key)
+{
+    for(lf_reader *open = sReaders; open != NULL; open = open->next)
+    {
+        LF_ASSERT(open == reader, LF_RESULT_INVALID_STATE);
+    }
+
+    // the file is not complete yet or its blocks are being erased
+    LF_ASSERT(sEditMode == LF_MODE_WRITING && sKey == key, LF_RESULT_NOT_EXISTS);
+    LF_ASSERT(sDeletedKey == key || sDeletedKey == LF_KEY_ALL, LF_RESULT_NOT_EXISTS);
+#if LF_USE_TRANSACTIONS
+    // the versions of the file are being replaced
+    LF_ASSERT(sTxn.committing && LF_TXN_HAS(key), LF_RESULT_NOT_EXISTS);
+#endif
+
+    reader->key = key;
+    reader->open = 1;
+    reader->next = sReaders;
+    sReaders = reader;
+    return LF_RESULT_SUCCESS;
+}
 
-        if(sNextBlock == LF_BLOCK_NONE)
+// removes the reader from the open ones, called with the lock held
+static void remove_reader(lf_reader *reader)
+{
+    for(lf_reader **open = &sReaders; *open != NULL; open = &(*open)->next)
+    {
+        if(*open == reader)
         {
+            *open = reader->next;
             break;
         }
+    }
+    reader->open = 0;
+}
 
-        sCurrentBlock = sNextBlock;
-        result = lf_app_read(sCurrentBlock, 1, &sNextBlock, 2);
-        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+// starts writing mode, called with the lock held
+static lf_result_t start_writing(uint8_t key)
+{
+    LF_ASSERT(sEditMode != LF_MODE_NONE || sDeletedKey == LF_KEY_ALL, LF_RESULT_INVALID_STATE);
+    LF_ASSERT(is_open(key) || sDeletedKey == key, LF_RESULT_ALREADY_EXISTS);
+
+    sKey = key;
+    sEditMode = LF_MODE_WRITING;
+    sWritten.current = LF_BLOCK_NONE;
+    sWritten.next = LF_BLOCK_NONE;
+    return LF_RESULT_SUCCESS;
+}
+
+// marks the key as deleted, called with the lock held
+static lf_result_t start_deleting(uint8_t key)
+{
+    LF_ASSERT(sDeletedKey != LF_KEY_FREE, LF_RESULT_INVALID_STATE);
+#if LF_USE_TRANSACTIONS
+    LF_ASSERT(sTxn.committing, LF_RESULT_INVALID_STATE);
+#endif
+    if(key == LF_KEY_ALL)
+    {
+        LF_ASSERT(sEditMode != LF_MODE_NONE || sReaders != NULL, LF_RESULT_INVALID_STATE);
     }
+    else
+    {
+        LF_ASSERT(is_open(key), LF_RESULT_INVALID_STATE);
+    }
+
+    sDeletedKey = key;
+    return LF_RESULT_SUCCESS;
+}
+
+static lf_result_t exists_impl(uint8_t key)
+{
+    LF_ASSERT(key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+
+    block_info_t info;
+    lf_result_t result = findBlock(&info, key, 0);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    if(info.block == LF_BLOCK_NONE)
+    {
+        result = LF_RESULT_NOT_EXISTS;
+    }
+
+    return result; 
+}
+
+static lf_result_t find_new_file(uint8_t key)
+{
+    block_info_t info;
+#if LF_USE_TRANSACTIONS
+    // a transaction writes new versions of the existing files
+    lf_result_t result = findVersion(&info, key, 0, sTxn.active);
+#else
+    lf_result_t result = findBlock(&info, key, 0);
+#endif
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(info.block != LF_BLOCK_NONE, LF_RESULT_ALREADY_EXISTS);
+
+    result = allocate_written(&info.block, LF_BLOCK_NONE);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    // the readers following the file start on its first block
+    LF_LOCK();
+    sFirstBlock = info.block;
+    LF_UNLOCK();
+    sCurrentBlock = info.block;
+    sCursor = 0;
+    sContentSize = 0;
+#if LF_USE_CRC
+    sCrc = 0;
+#endif
+
+    return result;
+}
+
+// open for write
+static lf_result_t create_impl(uint8_t key)
+{
+    // validate args
+    LF_ASSERT(key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+
+    // validate state
+    LF_LOCK();
+    lf_result_t result = start_writing(key);
+    LF_UNLOCK();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    result = find_new_file(key);
+    if(result != LF_RESULT_SUCCESS)
+    {
+        LF_LOCK();
+        sEditMode = LF_MODE_NONE;
+        LF_UNLOCK();
+    }
+
+    sFlags = 0;
+#if LF_USE_TRANSACTIONS
+    if(sTxn.active && result == LF_RESULT_SUCCESS)
+    {
+        sFlags = LF_FILE_FLAG_PENDING;
+        sTxn.keys[key >> 3] |= (1u << (key & 7));
+    }
+#endif
+#if LF_USE_RECORDS
+    sRecordSize = 0;
+#endif
+#if LF_USE_COMPRESSION
+    sEncoder.window = NULL;
+#endif
+#if LF_USE_TAIL
+    if(result == LF_RESULT_SUCCESS)
+    {
+        publish_tail();
+    }
+#endif
 
     return result;
 }
+
+// space for the data in the written block, record files keep only whole records in it
+static uint16_t block_capacity(uint8_t leading)
+{
+    uint16_t capacity = LF_MEMORY_BLOCK_SIZE - LF_DATA_OFFSET(leading);
+#if LF_USE_RECORDS
+    if(sRecordSize != 0)
+    {
+        capacity -= capacity % sRecordSize;
+    }
+#endif
+    return capacity;
+}
+
+// writes the data as it is stored in the blocks
+static lf_result_t write_data(void *content, size_t length)
+{
+    if(length == 0)
+    {
+        return LF_RESULT_SUCCESS;
+    }
+
+    lf_result_t result = LF_RESULT_SUCCESS;
+    size_t contentOffset = 0;
+
+    while(1)
+    {
+        size_t spaceLeft = block_capacity(sCurrentBlock == sFirstBlock) - sCursor;
+        if(spaceLeft == 0)
+        {
+            // find new block
+            block_info_t info;
+            result = allocate_written(&info.block, sCurrentBlock);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+            // update current block header
+            sNextBlock = info.block;
+            result = save_current_block();
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+            // switch to the new block
+            sCurrentBlock = info.block;
+            sCursor = 0;
+#if LF_USE_CRC
+            sCrc = 0;
+#endif
+
+            spaceLeft = block_capacity(0);
+        }
+
+        size_t toSaveSize = (length > spaceLeft) ? spaceLeft : length;
+        result = write_current_block((uint8_t*)content + contentOffset, toSaveSize);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        sCursor += toSaveSize;
+
+        // if thats all
+        if(toSaveSize == length)
+        {
+            break;
+        }
+        
+        contentOffset += toSaveSize;
+        length -= toSaveSize;
+    }
+
+    return result;
+}
+
+#if LF_USE_COMPRESSION
+// returns the window bits for the workspace, 0 if it is too small
+static uint8_t window_bits(size_t size)
+{
+    uint8_t bits = 0;
+    while(bits < LF_WINDOW_BITS_MAX && LF_COMPRESSION_WORKSPACE_SIZE(bits + 1) <= size)
+    {
+        ++bits;
+    }
+    return (bits < LF_WINDOW_BITS_MIN) ? 0 : bits;
+}
+
+static lf_result_t encoder_flush(void)
+{
+    lf_result_t result = write_data(sEncoder.output, sEncoder.outputLength);
+    sEncoder.outputLength = 0;
+    return result;
+}
+
+// encodes the beginning of the lookahead as a literal or a match
+static lf_result_t encode_item(void)
+{
+    uint8_t *window = sEncoder.window;
+    uint8_t *lookahead = sEncoder.lookahead;
+
+    // the longest match, it can continue into the lookahead
+    uint8_t bestLength = 0;
+    uint16_t bestDistance = 0;
+    for(uint16_t distance = 1; distance <= sEncoder.windowFill && bestLength < sEncoder.lookaheadLength; ++distance)
+    {
+        uint8_t length = 0;
+        while(length < sEncoder.lookaheadLength)
+        {
+            uint8_t byte = (length < distance) ? window[(sEncoder.windowPos - distance + length) & sEncoder.windowMask] : lookahead[length - distance];
+            if(byte != lookahead[length])
+            {
+                break;
+            }
+            ++length;
+        }
+        if(length > bestLength)
+        {
+            bestLength = length;
+            bestDistance = distance;
+        }
+    }
+
+    if(sEncoder.itemCount == 0)
+    {
+        sEncoder.flagsPos = sEncoder.outputLength;
+        sEncoder.output[sEncoder.outputLength++] = 0;
+    }
+
+    uint8_t consumed;
+    if(bestLength >= LF_MATCH_MIN)
+    {
+        sEncoder.output[sEncoder.outputLength++] = (uint8_t)(bestDistance - 1);
+        sEncoder.output[sEncoder.outputLength++] = (uint8_t)((((bestDistance - 1) >> 8) << 4) | (bestLength - LF_MATCH_MIN));
+        consumed = bestLength;
+    }
+    else
+    {
+        sEncoder.output[sEncoder.flagsPos] |= (uint8_t)(1 << sEncoder.itemCount);
+        sEncoder.output[sEncoder.outputLength++] = lookahead[0];
+        consumed = 1;
+    }
+
+    // move the encoded bytes to the window
+    for(uint8_t i = 0; i < consumed; ++i)
+    {
+        window[sEncoder.windowPos] = lookahead[i];
+        sEncoder.windowPos = (sEncoder.windowPos + 1) & sEncoder.windowMask;
+    }
+    if(sEncoder.windowFill <= sEncoder.windowMask)
+    {
+        sEncoder.windowFill += consumed;
+        if(sEncoder.windowFill > sEncoder.windowMask)
+        {
+            sEncoder.windowFill = sEncoder.windowMask + 1;
+        }
+    }
+    sEncoder.lookaheadLength -= consumed;
+    memmove(lookahead, lookahead + consumed, sEncoder.lookaheadLength);
+
+    // only complete groups are written
+    if(++sEncoder.itemCount == 8)
+    {
+        sEncoder.itemCount = 0;
+        if(sEncoder.outputLength + LF_GROUP_MAX_SIZE > LF_COMPRESSION_BUFFER_SIZE - LF_MATCH_MAX)
+        {
+            return encoder_flush();
+        }
+    }
+    return LF_RESULT_SUCCESS;
+}
+
+static lf_result_t compress_data(uint8_t *content, size_t length)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    while(length > 0)
+    {
+        size_t toCopySize = LF_MATCH_MAX - sEncoder.lookaheadLength;
+        if(toCopySize > length)
+        {
+            toCopySize = length;
+        }
+        memcpy(sEncoder.lookahead + sEncoder.lookaheadLength, content, toCopySize);
+        sEncoder.lookaheadLength += toCopySize;
+        content += toCopySize;
+        length -= toCopySize;
+
+        // a match is searched only with the full lookahead
+        if(sEncoder.lookaheadLength == LF_MATCH_MAX)
+        {
+            result = encode_item();
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+    }
+    return result;
+}
+
+static lf_result_t compress_end(void)
+{
+    while(sEncoder.lookaheadLength > 0)
+    {
+        lf_result_t result = encode_item();
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+    return encoder_flush();
+}
+
+static lf_result_t create_compressed_impl(uint8_t key, void *workspace, size_t size)
+{
+    uint8_t bits = window_bits(size);
+    LF_ASSERT(workspace == NULL || bits == 0, LF_RESULT_INVALID_ARGS);
+
+    lf_result_t result = create_impl(key);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    sFlags |= LF_FILE_FLAG_COMPRESSED | (bits << LF_FILE_WINDOW_SHIFT);
+    sEncoder.window = (uint8_t*)workspace;
+    sEncoder.windowMask = (1u << bits) - 1;
+    sEncoder.windowPos = 0;
+    sEncoder.windowFill = 0;
+    sEncoder.lookahead = sEncoder.window + (1u << bits);
+    sEncoder.lookaheadLength = 0;
+    sEncoder.output = sEncoder.lookahead + LF_MATCH_MAX;
+    sEncoder.outputLength = 0;
+    sEncoder.itemCount = 0;
+
+    return result;
+}
+#endif
+
+static lf_result_t write_impl(void *content, size_t length)
+{
+    // validate state
+    LF_ASSERT(sEditMode != LF_MODE_WRITING, LF_RESULT_INVALID_STATE);
+
+    sContentSize += length;
+#if LF_USE_COMPRESSION
+    if(sEncoder.window != NULL)
+    {
+        return compress_data((uint8_t*)content, length);
+    }
+#endif
+#if LF_USE_TAIL
+    // the headers of the finished blocks are saved before the followers are moved on
+    lf_result_t result = write_data(content, length);
+    publish_tail();
+    return result;
+#else
+    return write_data(content, length);
+#endif
+}
+
+static lf_result_t save_impl(void)
+{
+    // validate state
+    if(sEditMode != LF_MODE_WRITING)
+    {
+        return LF_RESULT_INVALID_STATE;
+    }
+
+    lf_result_t result = LF_RESULT_SUCCESS;
+#if LF_USE_COMPRESSION
+    if(sEncoder.window != NULL)
+    {
+        result = compress_end();
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+#endif
+
+    // update current block header
+    sNextBlock = LF_BLOCK_NONE;
+    result = save_current_block();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+#if LF_USE_FILE_ATTRIBUTES
+    // the leading block was saved before the content size was known
+    if(sCurrentBlock != sFirstBlock)
+    {
+        result = app_write(sFirstBlock, LF_BLOCK_HEADER_SIZE + 1, &sContentSize, 4, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+#endif
+
+    LF_LOCK();
+    sEditMode = LF_MODE_NONE;
+#if LF_USE_TAIL
+    sTail.block = LF_BLOCK_NONE;
+#endif
+    LF_UNLOCK();
+
+    return result;
+}
+
+#if LF_USE_COMPRESSION
+// prepares the decompression of the file with the 'flags'
+static lf_result_t decoder_init(lf_reader *reader, uint8_t flags, void *workspace, size_t size)
+{
+    reader->window = NULL;
+    if(!(flags & LF_FILE_FLAG_COMPRESSED))
+    {
+        return LF_RESULT_SUCCESS;
+    }
+
+    uint8_t bits = flags >> LF_FILE_WINDOW_SHIFT;
+    LF_ASSERT(workspace == NULL || size < LF_COMPRESSION_WORKSPACE_SIZE(bits), LF_RESULT_INVALID_ARGS);
+
+    reader->window = (uint8_t*)workspace;
+    reader->windowMask = (1u << bits) - 1;
+    reader->windowPos = 0;
+    reader->matchLength = 0;
+    reader->itemCount = 0;
+    reader->inputPos = 0;
+    reader->inputLength = 0;
+    return LF_RESULT_SUCCESS;
+}
+#endif
+
+// sets the reader to the beginning of the file with the leading block 'block' and its 'header'
+static void reader_start(lf_reader *reader, uint16_t block, const uint8_t *header)
+{
+    reader->currentBlock = block;
+    reader->nextBlock = *((uint16_t*)(header+1));
+    reader->cursor = 0;
+    reader->size = *((uint16_t*)(header+3));
+    reader->leading = 1;
+#if LF_USE_TAIL
+    reader->follow = 0;
+    reader->growing = 0;
+#endif
+#if LF_USE_CRC
+    reader->verify = 1;
+    reader->crc = 0;
+    reader->blockCrc = *((uint32_t*)(header+LF_BLOCK_LINK_SIZE));
+#endif
+}
+
+static lf_result_t reader_open_impl(lf_reader *reader, uint8_t key, void *workspace, size_t size)
+{
+    // validate args
+    LF_ASSERT(reader == NULL || key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+
+    block_info_t info;
+    lf_result_t result = findBlock(&info, key, 0);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(info.block == LF_BLOCK_NONE, LF_RESULT_NOT_EXISTS);
+
+    LF_LOCK();
+    result = add_reader(reader, key);
+    LF_UNLOCK();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    // the file could be deleted before the reader was added, so the header is read after that
+    uint8_t header[LF_LEADING_HEADER_SIZE];
+    result = app_read(info.block, 0, header, LF_LEADING_HEADER_SIZE);
+    if(result == LF_RESULT_SUCCESS && header[0] != (key | LF_INFO_LEADING_MASK))
+    {
+        result = LF_RESULT_NOT_EXISTS;
+    }
+#if LF_USE_COMPRESSION
+    if(result == LF_RESULT_SUCCESS)
+    {
+        result = decoder_init(reader, (uint8_t)~header[LF_BLOCK_HEADER_SIZE], workspace, size);
+    }
+#else
+    (void)workspace;
+    (void)size;
+#endif
+    if(result != LF_RESULT_SUCCESS)
+    {
+        LF_LOCK();
+        remove_reader(reader);
+        LF_UNLOCK();
+        return result;
+    }
+
+    reader_start(reader, info.block, header);
+    return result;
+}
+
+// open for read
+static lf_result_t open_impl(uint8_t key, void *workspace, size_t size)
+{
+    // validate state
+    LF_LOCK();
+    uint8_t idle = (sEditMode == LF_MODE_NONE);
+    if(idle)
+    {
+        sEditMode = LF_MODE_READING;
+    }
+    LF_UNLOCK();
+    LF_ASSERT(!idle, LF_RESULT_INVALID_STATE);
+
+    lf_result_t result = reader_open_impl(&sReader, key, workspace, size);
+    if(result != LF_RESULT_SUCCESS)
+    {
+        LF_LOCK();
+        sEditMode = LF_MODE_NONE;
+        LF_UNLOCK();
+    }
+
+    return result;
+}
+
+#if LF_USE_CRC
+// adds the 'length' bytes of the current block passed by the reader to its CRC, 'data' is NULL if they were skipped
+static void crc_passed(lf_reader *reader, const void *data, size_t length)
+{
+    if(data == NULL)
+    {
+        // skipped data can not be checked
+        reader->verify = 0;
+    }
+    else if(reader->verify)
+    {
+        reader->crc = crc32(reader->crc, data, length);
+    }
+}
+
+// checks the CRC of the current block once all its data was passed
+static lf_result_t verify_block(lf_reader *reader)
+{
+    if(!reader->verify || reader->cursor != reader->size)
+    {
+        return LF_RESULT_SUCCESS;
+    }
+#if LF_USE_TAIL
+    if(reader->growing)
+    {
+        // the CRC is saved with the block
+        return LF_RESULT_SUCCESS;
+    }
+#endif
+
+    reader->verify = 0;
+    LF_ASSERT(crc_block(reader->crc, reader->nextBlock, reader->size) != reader->blockCrc, LF_RESULT_CORRUPTED);
+    return LF_RESULT_SUCCESS;
+}
+#endif
+
+#if LF_USE_TAIL
+// updates the size of the block being written, or reads its header once the block is saved
+static lf_result_t follow_writer(lf_reader *reader)
+{
+    LF_LOCK();
+    uint8_t growing = (sTail.block == reader->currentBlock);
+    uint16_t flushed = sTail.flushed;
+    LF_UNLOCK();
+    if(growing)
+    {
+        reader->size = flushed;
+        return LF_RESULT_SUCCESS;
+    }
+
+    uint8_t header[LF_BLOCK_HEADER_SIZE - 1];
+    lf_result_t result = app_read(reader->currentBlock, 1, header, LF_BLOCK_HEADER_SIZE - 1);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    reader->nextBlock = *((uint16_t*)(header));
+    reader->size = *((uint16_t*)(header+2));
+#if LF_USE_CRC
+    reader->blockCrc = *((uint32_t*)(header+LF_BLOCK_LINK_SIZE-1));
+#endif
+    reader->growing = 0;
+
+    // the writer stopped without saving the block
+    LF_ASSERT(reader->size == LF_BLOCK_SIZE_UNSAVED || reader->size < reader->cursor, LF_RESULT_FAILED);
+    return result;
+}
+#endif
+
+// moves to the following blocks until there is data left to read
+static lf_result_t load_data(lf_reader *reader, size_t *dataLeftSize)
+{
+    lf_result_t result;
+    while(1)
+    {
+#if LF_USE_TAIL
+        if(reader->growing)
+        {
+            result = follow_writer(reader);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+#endif
+        *dataLeftSize = reader->size - reader->cursor;
+        if(*dataLeftSize != 0)
+        {
+            return LF_RESULT_SUCCESS;
+        }
+#if LF_USE_TAIL
+        LF_ASSERT(reader->growing, LF_RESULT_NO_DATA);
+#endif
+
+#if LF_USE_CRC
+        // a block without data is checked when it is left
+        result = verify_block(reader);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+#endif
+
+        if(reader->nextBlock == LF_BLOCK_NONE)
+        {
+            return LF_RESULT_END_OF_FILE;
+        }
+
+#if LF_USE_TAIL
+        // the block being written is told by the writer, before its header is read - the header
+        // of a block of a rewritable memory is not erased, it keeps the size of its old data
+        uint8_t growing = 0;
+        if(reader->follow)
+        {
+            LF_LOCK();
+            growing = (sTail.block == reader->nextBlock);
+            LF_UNLOCK();
+        }
+#endif
+
+        // cache next block
+        uint8_t header[LF_BLOCK_HEADER_SIZE - 1];
+        result = app_read(reader->nextBlock, 1, header, LF_BLOCK_HEADER_SIZE - 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        reader->currentBlock = reader->nextBlock;
+        reader->nextBlock = *((uint16_t*)(header));
+        reader->cursor = 0;
+        reader->size = *((uint16_t*)(header+2));
+        reader->leading = 0;
+#if LF_USE_CRC
+        reader->verify = 1;
+        reader->crc = 0;
+        reader->blockCrc = *((uint32_t*)(header+LF_BLOCK_LINK_SIZE-1));
+#endif
+#if LF_USE_TAIL
+        reader->growing = growing;
+#endif
+    }
+}
+
+// reads the data as it is stored in the blocks, 'readLength' is increased also when the end of the file is reached
+static lf_result_t read_stored(lf_reader *reader, void *content, size_t length, size_t *readLength)
+{
+    if(length == 0)
+    {
+        return LF_RESULT_SUCCESS;
+    }
+
+    lf_result_t result = LF_RESULT_SUCCESS;
+
+    while(1)
+    {
+        // check if current block contains enough data
+        size_t dataLeftSize;
+        result = load_data(reader, &dataLeftSize);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+        size_t toReadSize = (length > dataLeftSize) ? dataLeftSize : length;
+        if(content != NULL)
+        {
+            result = app_read(reader->currentBlock, LF_DATA_OFFSET(reader->leading) + reader->cursor, (uint8_t*)content + *readLength, toReadSize);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+        reader->cursor += toReadSize;
+#if LF_USE_CRC
+        crc_passed(reader, (content != NULL) ? (uint8_t*)content + *readLength : NULL, toReadSize);
+        result = verify_block(reader);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+#endif
+        *readLength += toReadSize;
+
+        // if thats all
+        if(toReadSize == length)
+        {
+            break;
+        }
+
+        length -= toReadSize;
+    }
+
+    return result;
+}
+
+#if LF_USE_COMPRESSION
+// gets the next byte of the compressed data
+static lf_result_t decoder_input(lf_reader *reader, uint8_t *byte)
+{
+    uint8_t *input = reader->window + reader->windowMask + 1;
+    if(reader->inputPos == reader->inputLength)
+    {
+        size_t readLength = 0;
+        lf_result_t result = read_stored(reader, input, LF_COMPRESSION_BUFFER_SIZE, &readLength);
+        LF_ASSERT(readLength == 0, (result == LF_RESULT_SUCCESS) ? LF_RESULT_END_OF_FILE : result);
+        reader->inputPos = 0;
+        reader->inputLength = (uint8_t)readLength;
+    }
+    *byte = input[reader->inputPos++];
+    return LF_RESULT_SUCCESS;
+}
+
+static lf_result_t decompress_data(lf_reader *reader, uint8_t *content, size_t length, size_t *readLength)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    uint8_t *window = reader->window;
+
+    while(*readLength < length)
+    {
+        uint8_t byte;
+        if(reader->matchLength == 0)
+        {
+            // next item
+            if(reader->itemCount == 0)
+            {
+                result = decoder_input(reader, &reader->itemFlags);
+                LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+                reader->itemCount = 8;
+            }
+
+            result = decoder_input(reader, &byte);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+            uint8_t literal = reader->itemFlags & 1;
+            reader->itemFlags >>= 1;
+            --reader->itemCount;
+
+            if(!literal)
+            {
+                uint8_t second;
+                result = decoder_input(reader, &second);
+                LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+                reader->matchDistance = (byte | ((uint16_t)(second >> 4) << 8)) + 1;
+                reader->matchLength = (second & 0x0f) + LF_MATCH_MIN;
+                LF_ASSERT(reader->matchDistance > reader->windowMask + 1, LF_RESULT_FAILED);
+            }
+        }
+
+        if(reader->matchLength != 0)
+        {
+            byte = window[(reader->windowPos - reader->matchDistance) & reader->windowMask];
+            --reader->matchLength;
+        }
+
+        window[reader->windowPos] = byte;
+        reader->windowPos = (reader->windowPos + 1) & reader->windowMask;
+        if(content != NULL)
+        {
+            content[*readLength] = byte;
+        }
+        ++*readLength;
+    }
+
+    return result;
+}
+#endif
+
+// reads up to 'length' bytes, 'readLength' is set also when the end of the file is reached
+static lf_result_t read_data(lf_reader *reader, void *content, size_t length, size_t *readLength)
+{
+    *readLength = 0;
+
+    // validate state
+    LF_ASSERT(reader == NULL || !reader->open, LF_RESULT_INVALID_STATE);
+
+#if LF_USE_COMPRESSION
+    if(reader->window != NULL)
+    {
+        return decompress_data(reader, (uint8_t*)content, length, readLength);
+    }
+#endif
+    return read_stored(reader, content, length, readLength);
+}
+
+static lf_result_t read_impl(lf_reader *reader, void *content, size_t length)
+{
+    size_t readLength;
+    return read_data(reader, content, length, &readLength);
+}
+
+static lf_result_t read_some_impl(lf_reader *reader, void *content, size_t length, size_t *readLength)
+{
+    LF_ASSERT(readLength == NULL, LF_RESULT_INVALID_ARGS);
+
+    lf_result_t result = read_data(reader, content, length, readLength);
+    if((result == LF_RESULT_END_OF_FILE || result == LF_RESULT_NO_DATA) && *readLength != 0)
+    {
+        result = LF_RESULT_SUCCESS;
+    }
+    return result;
+}
+
+#if LF_USE_MAP
+static lf_result_t read_direct_impl(const void **content, size_t *length)
+{
+    // validate state
+    LF_ASSERT(!sReader.open, LF_RESULT_INVALID_STATE);
+#if LF_USE_COMPRESSION
+    LF_ASSERT(sReader.window != NULL, LF_RESULT_INVALID_STATE);
+#endif
+
+    // validate args
+    LF_ASSERT(content == NULL || length == NULL, LF_RESULT_INVALID_ARGS);
+
+    if(*length == 0)
+    {
+        return LF_RESULT_SUCCESS;
+    }
+
+    size_t dataLeftSize;
+    lf_result_t result = load_data(&sReader, &dataLeftSize);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+#if LF_USE_BAD_BLOCKS
+    const uint8_t *block = (const uint8_t*)lf_app_map(remap(sReader.currentBlock));
+#else
+    const uint8_t *block = (const uint8_t*)lf_app_map(sReader.currentBlock);
+#endif
+    LF_ASSERT(block == NULL, LF_RESULT_FAILED);
+
+    if(*length > dataLeftSize)
+    {
+        *length = dataLeftSize;
+    }
+    *content = block + LF_DATA_OFFSET(sReader.leading) + sReader.cursor;
+    sReader.cursor += *length;
+#if LF_USE_CRC
+    crc_passed(&sReader, *content, *length);
+    result = verify_block(&sReader);
+#endif
+
+    return result;
+}
+#endif
+
+static lf_result_t reader_close_impl(lf_reader *reader)
+{
+    LF_ASSERT(reader == NULL || !reader->open, LF_RESULT_INVALID_STATE);
+    LF_LOCK();
+    remove_reader(reader);
+    LF_UNLOCK();
+    return LF_RESULT_SUCCESS;
+}
+
+#if LF_USE_TAIL
+static lf_result_t reader_follow_impl(lf_reader *reader, uint8_t key)
+{
+    // validate args
+    LF_ASSERT(reader == NULL || key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+
+    LF_LOCK();
+    uint8_t writing = (sEditMode == LF_MODE_WRITING && sKey == key);
+    lf_result_t result = LF_RESULT_SUCCESS;
+    for(lf_reader *open = sReaders; writing && open != NULL; open = open->next)
+    {
+        if(open == reader)
+        {
+            result = LF_RESULT_INVALID_STATE;
+        }
+    }
+#if LF_USE_COMPRESSION
+    if(writing && sEncoder.window != NULL)
+    {
+        // the compressed data can not be decoded before it is complete
+        result = LF_RESULT_INVALID_ARGS;
+    }
+#endif
+    if(writing && result == LF_RESULT_SUCCESS)
+    {
+        // the leading block gets its header when it is saved, so it is taken from the writer
+        reader->key = key;
+        reader->open = 1;
+        reader->next = sReaders;
+        sReaders = reader;
+        reader->currentBlock = sFirstBlock;
+        reader->nextBlock = LF_BLOCK_NONE;
+        reader->cursor = 0;
+        reader->size = 0;
+        reader->leading = 1;
+        reader->growing = 1;
+#if LF_USE_CRC
+        reader->verify = 1;
+        reader->crc = 0;
+#endif
+#if LF_USE_COMPRESSION
+        reader->window = NULL;
+#endif
+    }
+    LF_UNLOCK();
+
+    if(!writing)
+    {
+        result = reader_open_impl(reader, key, NULL, 0);
+    }
+    if(result == LF_RESULT_SUCCESS)
+    {
+        reader->follow = 1;
+    }
+    return result;
+}
+
+static lf_result_t reader_wait_impl(lf_reader *reader)
+{
+    // validate state
+    LF_ASSERT(reader == NULL || !reader->open, LF_RESULT_INVALID_STATE);
+
+    while(1)
+    {
+        size_t dataLeftSize;
+        lf_result_t result = load_data(reader, &dataLeftSize);
+        if(result != LF_RESULT_NO_DATA)
+        {
+            return result;
+        }
+        lf_app_wait();
+    }
+}
+#endif
+
+static lf_result_t close_impl(void)
+{
+    LF_ASSERT(sEditMode != LF_MODE_READING, LF_RESULT_INVALID_STATE);
+    LF_LOCK();
+    remove_reader(&sReader);
+    sEditMode = LF_MODE_NONE;
+    LF_UNLOCK();
+    return LF_RESULT_SUCCESS;
+}
+
+static lf_result_t size_impl(uint8_t key, uint32_t *size)
+{
+    LF_ASSERT(key > LF_KEY_MAX || size == NULL, LF_RESULT_INVALID_ARGS);
+
+    block_info_t info;
+    lf_result_t result = findBlock(&info, key, 1);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(info.block == LF_BLOCK_NONE, LF_RESULT_NOT_EXISTS);
+
+#if LF_USE_FILE_ATTRIBUTES
+    result = app_read(info.block, LF_BLOCK_HEADER_SIZE + 1, size, 4);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(*size == LF_SIZE_UNKNOWN, LF_RESULT_NOT_EXISTS);
+#else
+    // sum of the blocks
+    *size = info.size;
+    uint16_t block = info.nextBlock;
+    while(block != LF_BLOCK_NONE)
+    {
+        uint16_t header[2];
+        result = app_read(block, 1, header, 4);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        block = header[0];
+        *size += header[1];
+    }
+#endif
+
+    return result;
+}
+
+#if LF_USE_KV || LF_USE_TRANSACTIONS || LF_USE_OVERWRITE || LF_USE_COPY || LF_USE_BAD_BLOCKS
+// erases a single block, or marks it as free on rewritable memories
+static lf_result_t release_block(uint16_t block)
+{
+    if(LF_MEMORY_REWRITABLE)
+    {
+        return invalidate_block(block);
+    }
+#if LF_USE_ERASE_RANGE
+    return app_erase_range(block, 1);
+#else
+    return app_delete(block);
+#endif
+}
+#endif
+
+// erases the blocks of the file starting on its leading block
+static lf_result_t delete_chain(uint16_t block, uint16_t nextBlock)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+
+#if LF_USE_ERASE_RANGE
+    // contiguous blocks of the chain are erased together
+    uint16_t rangeBlock = block;
+    uint16_t rangeCount = 0;
+#endif
+
+    while(1)
+    {
+        if(LF_MEMORY_REWRITABLE)
+        {
+            result = invalidate_block(block);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+        else
+        {
+#if LF_USE_ERASE_RANGE
+            if(block != rangeBlock + rangeCount)
+            {
+                result = app_erase_range(rangeBlock, rangeCount);
+                LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+                rangeBlock = block;
+                rangeCount = 0;
+            }
+            ++rangeCount;
+#else
+            // erase block
+            result = app_delete(block);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+#endif
+        }
+
+        if(nextBlock == LF_BLOCK_NONE)
+        {
+            break;
+        }
+
+        block = nextBlock;
+        result = app_read(block, 1, &nextBlock, 2);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+
+#if LF_USE_ERASE_RANGE
+    if(rangeCount != 0)
+    {
+        result = app_erase_range(rangeBlock, rangeCount);
+    }
+#endif
+
+    return result;
+}
+
+static lf_result_t delete_file(uint8_t key)
+{
+    // find block
+    block_info_t info;
+    lf_result_t result = findBlock(&info, key, 1);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(info.block == LF_BLOCK_NONE, LF_RESULT_NOT_EXISTS);
+
+    return delete_chain(info.block, info.nextBlock);
+}
+
+static lf_result_t delete_impl(uint8_t key)
+{
+    LF_ASSERT(key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+
+    LF_LOCK();
+    lf_result_t result = start_deleting(key);
+    LF_UNLOCK();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    // the blocks are erased without the lock
+    result = delete_file(key);
+
+    LF_LOCK();
+    sDeletedKey = LF_KEY_FREE;
+    LF_UNLOCK();
+
+    return result;
+}
+
+static lf_result_t format_memory(void)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+
+#if LF_USE_BAD_BLOCKS
+    // the retired blocks and the table are kept
+    for(uint16_t block = 0; block < LF_MEMORY_BLOCK_COUNT; ++block)
+    {
+        if(!is_bad(block) && block != sBad.tableBlock)
+        {
+            result = release_block(block);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+    }
+#else
+    if(LF_MEMORY_REWRITABLE)
+    {
+        for(uint16_t block = 0; block < LF_MEMORY_BLOCK_COUNT; ++block)
+        {
+            result = invalidate_block(block);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+    }
+    else
+    {
+#if LF_USE_ERASE_RANGE
+        result = app_erase_range(0, LF_MEMORY_BLOCK_COUNT);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+#else
+        for(uint16_t block = 0; block < LF_MEMORY_BLOCK_COUNT; ++block)
+        {
+            result = app_delete(block);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+#endif
+    }
+#endif
+
+    return result;
+}
+
+static lf_result_t format_impl(void)
+{
+    LF_LOCK();
+    lf_result_t result = start_deleting(LF_KEY_ALL);
+    LF_UNLOCK();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    result = format_memory();
+
+    LF_LOCK();
+    sBlock = 0;
+    sLastFreeBlock = LF_BLOCK_NONE;
+    sDeletedKey = LF_KEY_FREE;
+    LF_UNLOCK();
+#if LF_USE_KV
+    sKv.loaded = 0;
+#endif
+#if LF_USE_TRANSACTIONS
+    memset(&sTxn, 0, sizeof(sTxn));
+#endif
+
+    return result;
+}
+
+#if LF_USE_KV || LF_USE_COPY || ((LF_USE_RECORDS || LF_USE_OVERWRITE) && !LF_USE_CRC)
+// programs the bytes directly, never crossing a program page
+static lf_result_t program_direct(uint16_t block, uint16_t offset, const void *data, size_t length)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    const uint8_t *content = (const uint8_t*)data;
+
+    while(length > 0)
+    {
+        size_t toSaveSize = length;
+        if(LF_MEMORY_PAGE_SIZE != 0 && (offset % LF_MEMORY_PAGE_SIZE) + toSaveSize > LF_MEMORY_PAGE_SIZE)
+        {
+            toSaveSize = LF_MEMORY_PAGE_SIZE - (offset % LF_MEMORY_PAGE_SIZE);
+        }
+        result = app_write(block, offset, (void*)content, toSaveSize, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+        offset += toSaveSize;
+        content += toSaveSize;
+        length -= toSaveSize;
+    }
+
+    return result;
+}
+#endif
+
+#if (LF_USE_RECORDS || LF_USE_OVERWRITE) && !LF_USE_CRC
+// checks that programming the data over the stored bytes only clears bits (always true on rewritable memories)
+static lf_result_t can_program(uint16_t block, uint16_t offset, const void *data, size_t length)
+{
+    if(LF_MEMORY_REWRITABLE)
+    {
+        return LF_RESULT_SUCCESS;
+    }
+
+    lf_result_t result = LF_RESULT_SUCCESS;
+    const uint8_t *content = (const uint8_t*)data;
+    for(size_t checked = 0; checked < length; )
+    {
+        uint8_t stored[LF_STACK_BUFFER_SIZE];
+        size_t toCheckSize = (length - checked > LF_STACK_BUFFER_SIZE) ? LF_STACK_BUFFER_SIZE : (length - checked);
+        result = app_read(block, (uint16_t)(offset + checked), stored, toCheckSize);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        for(size_t i = 0; i < toCheckSize; ++i)
+        {
+            LF_ASSERT((stored[i] & content[checked + i]) != content[checked + i], LF_RESULT_INVALID_STATE);
+        }
+        checked += toCheckSize;
+    }
+    return result;
+}
+#endif
+
+#if LF_USE_KV
+// returns the entry of the key, or the empty entry for it, NULL if the index is full
+static kv_entry_t *kv_find(uint16_t key)
+{
+    uint16_t slot = (uint16_t)(key * 40503u) % LF_KV_INDEX_SIZE;
+    for(uint16_t probe = 0; probe < LF_KV_INDEX_SIZE; ++probe)
+    {
+        kv_entry_t *entry = &sKv.index[slot];
+        if(entry->block == LF_BLOCK_NONE || entry->key == key)
+        {
+            return entry;
+        }
+        slot = (slot + 1) % LF_KV_INDEX_SIZE;
+    }
+    return NULL;
+}
+
+static kv_block_t *kv_block(uint16_t block)
+{
+    for(uint8_t i = 0; i < sKv.blockCount; ++i)
+    {
+        if(sKv.blocks[i].block == block)
+        {
+            return &sKv.blocks[i];
+        }
+    }
+    return NULL;
+}
+
+// points the entry to the new record, the previous one becomes outdated
+static void kv_update(kv_entry_t *entry, uint16_t key, uint16_t block, uint16_t offset, uint8_t length)
+{
+    if(entry->block != LF_BLOCK_NONE)
+    {
+        kv_block(entry->block)->dead += LF_KV_RECORD_SIZE(entry->length);
+    }
+    entry->key = key;
+    entry->block = block;
+    entry->offset = offset;
+    entry->length = length;
+}
+
+// indexes the committed records of the block and finds its end
+static lf_result_t kv_scan(kv_block_t *log)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    uint16_t offset = LF_BLOCK_HEADER_SIZE;
+
+    while(offset + LF_KV_RECORD_SIZE(0) <= LF_MEMORY_BLOCK_SIZE)
+    {
+        uint8_t header[LF_KV_RECORD_HEADER_SIZE];
+        result = app_read(log->block, offset, header, LF_KV_RECORD_HEADER_SIZE);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(header[0] == LF_KV_LENGTH_END)
+        {
+            break;
+        }
+
+        uint16_t size = LF_KV_RECORD_SIZE(header[0]);
+        if(offset + size > LF_MEMORY_BLOCK_SIZE)
+        {
+            // damaged length, the rest of the block is not used
+            log->dead += LF_MEMORY_BLOCK_SIZE - offset;
+            offset = LF_MEMORY_BLOCK_SIZE;
+            break;
+        }
+
+        uint8_t mark;
+        result = app_read(log->block, offset + size - 1, &mark, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(mark == LF_KV_COMMITTED)
+        {
+            uint16_t key = header[1] | ((uint16_t)header[2] << 8);
+            kv_entry_t *entry = kv_find(key);
+            LF_ASSERT(entry == NULL, LF_RESULT_OUT_OF_MEMORY);
+            kv_update(entry, key, log->block, offset, header[0]);
+        }
+        else
+        {
+            // interrupted write
+            log->dead += size;
+        }
+        offset += size;
+    }
+
+    log->end = offset;
+    return result;
+}
+
+// finds the log blocks and builds the index
+static lf_result_t kv_load(void)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+
+    sKv.blockCount = 0;
+    for(uint16_t slot = 0; slot < LF_KV_INDEX_SIZE; ++slot)
+    {
+        sKv.index[slot].block = LF_BLOCK_NONE;
+    }
+
+    for(uint16_t block = 0; block < LF_MEMORY_BLOCK_COUNT; ++block)
+    {
+        if(LF_IS_BAD(block))
+        {
+            continue;
+        }
+        uint8_t header[LF_BLOCK_LINK_SIZE];
+        result = app_read(block, 0, header, sizeof(header));
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(header[0] != LF_INFO_SYSTEM || (header[3] | (header[4] << 8)) != LF_SYSTEM_KV)
+        {
+            continue;
+        }
+        LF_ASSERT(sKv.blockCount > LF_KV_MAX_BLOCKS, LF_RESULT_INVALID_CONFIG);
+
+        // insert sorted by the sequence number, which can wrap around
+        uint16_t sequence = header[1] | ((uint16_t)header[2] << 8);
+        uint8_t i = sKv.blockCount++;
+        while(i > 0 && (int16_t)(sequence - sKv.blocks[i - 1].sequence) < 0)
+        {
+            sKv.blocks[i] = sKv.blocks[i - 1];
+            --i;
+        }
+        sKv.blocks[i].block = block;
+        sKv.blocks[i].sequence = sequence;
+        sKv.blocks[i].dead = 0;
+    }
+
+    // the newer records replace the older ones
+    for(uint8_t i = 0; i < sKv.blockCount; ++i)
+    {
+        result = kv_scan(&sKv.blocks[i]);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+
+    sKv.loaded = 1;
+    return result;
+}
+
+// removes the log block from the memory and from the list
+static lf_result_t kv_release(uint8_t i)
+{
+    lf_result_t result = release_block(sKv.blocks[i].block);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    --sKv.blockCount;
+    for(; i < sKv.blockCount; ++i)
+    {
+        sKv.blocks[i] = sKv.blocks[i + 1];
+    }
+    return result;
+}
+
+// appends a record to the newest log block
+static lf_result_t kv_append(uint16_t key, const uint8_t *value, uint8_t length)
+{
+    kv_block_t *log = &sKv.blocks[sKv.blockCount - 1];
+    uint16_t offset = log->end;
+    uint16_t size = LF_KV_RECORD_SIZE(length);
+    uint8_t buffer[LF_STACK_BUFFER_SIZE];
+    lf_result_t result;
+
+    // on failure the space is not used again
+    log->end += size;
+
+    buffer[0] = length;
+    buffer[1] = (uint8_t)key;
+    buffer[2] = (uint8_t)(key >> 8);
+    if(size <= LF_STACK_BUFFER_SIZE)
+    {
+        // small records are programmed at once
+        if(length != 0)
+        {
+            memcpy(buffer + LF_KV_RECORD_HEADER_SIZE, value, length);
+        }
+        buffer[size - 1] = LF_KV_COMMITTED;
+        result = program_direct(log->block, offset, buffer, size);
+    }
+    else
+    {
+        result = program_direct(log->block, offset, buffer, LF_KV_RECORD_HEADER_SIZE);
+        if(result == LF_RESULT_SUCCESS)
+        {
+            result = program_direct(log->block, offset + LF_KV_RECORD_HEADER_SIZE, value, length);
+        }
+        if(result == LF_RESULT_SUCCESS)
+        {
+            buffer[0] = LF_KV_COMMITTED;
+            result = program_direct(log->block, offset + size - 1, buffer, 1);
+        }
+    }
+
+    if(result != LF_RESULT_SUCCESS)
+    {
+        log->dead += size;
+    }
+    return result;
+}
+
+// copies the live records of an older log block to the newest one
+static lf_result_t kv_move(uint16_t block)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    kv_block_t *log = &sKv.blocks[sKv.blockCount - 1];
+
+    for(uint16_t slot = 0; slot < LF_KV_INDEX_SIZE; ++slot)
+    {
+        kv_entry_t *entry = &sKv.index[slot];
+        if(entry->block != block)
+        {
+            continue;
+        }
+
+        // the commit mark is copied last
+        uint16_t size = LF_KV_RECORD_SIZE(entry->length);
+        for(uint16_t copied = 0; copied < size; )
+        {
+            uint8_t buffer[LF_STACK_BUFFER_SIZE];
+            uint16_t toCopySize = (size - copied > LF_STACK_BUFFER_SIZE) ? LF_STACK_BUFFER_SIZE : (size - copied);
+            result = app_read(block, entry->offset + copied, buffer, toCopySize);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            result = program_direct(log->block, log->end + copied, buffer, toCopySize);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            copied += toCopySize;
+        }
+
+        entry->block = log->block;
+        entry->offset = log->end;
+        log->end += size;
+    }
+
+    return result;
+}
+
+// starts a new log block with 'reserve' bytes free, then compacts the older blocks into it
+static lf_result_t kv_open_block(uint16_t reserve)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+
+    // the blocks without live records are released first
+    for(uint8_t i = 0; i < sKv.blockCount; )
+    {
+        if(sKv.blocks[i].end - LF_BLOCK_HEADER_SIZE == sKv.blocks[i].dead)
+        {
+            result = kv_release(i);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    // a compaction interrupted by a reset can leave one block more
+    LF_ASSERT(sKv.blockCount > LF_KV_MAX_BLOCKS, LF_RESULT_OUT_OF_MEMORY);
+
+    uint16_t block;
+    result = allocateBlock(&block);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(block == LF_BLOCK_NONE, LF_RESULT_OUT_OF_MEMORY);
+
+    if(LF_MEMORY_REWRITABLE)
+    {
+        // the end of the log is recognized by erased bytes
+        uint8_t erased[LF_STACK_BUFFER_SIZE];
+        memset(erased, 0xff, sizeof(erased));
+        for(uint16_t offset = LF_BLOCK_HEADER_SIZE; offset < LF_MEMORY_BLOCK_SIZE; offset += LF_STACK_BUFFER_SIZE)
+        {
+            uint16_t length = LF_MEMORY_BLOCK_SIZE - offset;
+            result = program_direct(block, offset, erased, (length > LF_STACK_BUFFER_SIZE) ? LF_STACK_BUFFER_SIZE : length);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+    }
+
+    kv_block_t *log = &sKv.blocks[sKv.blockCount];
+    log->block = block;
+    log->sequence = (sKv.blockCount == 0) ? 0 : (uint16_t)(sKv.blocks[sKv.blockCount - 1].sequence + 1);
+    log->end = LF_BLOCK_HEADER_SIZE;
+    log->dead = 0;
+
+    uint8_t header[3] = {LF_INFO_SYSTEM, (uint8_t)log->sequence, (uint8_t)(log->sequence >> 8)};
+    result = app_write(block, 0, header, sizeof(header), 1);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    ++sKv.blockCount;
+
+    // compaction, forced if there are too many blocks
+    for(uint8_t i = 0; i + 1 < sKv.blockCount; )
+    {
+        kv_block_t *old = &sKv.blocks[i];
+        uint16_t live = old->end - LF_BLOCK_HEADER_SIZE - old->dead;
+        uint16_t spaceLeft = LF_MEMORY_BLOCK_SIZE - sKv.blocks[sKv.blockCount - 1].end;
+        uint8_t outdated = ((uint32_t)old->dead * 100 >= (uint32_t)(LF_MEMORY_BLOCK_SIZE - LF_BLOCK_HEADER_SIZE) * LF_KV_COMPACT_PERCENT);
+        if((outdated || sKv.blockCount > LF_KV_MAX_BLOCKS) && live + reserve <= spaceLeft)
+        {
+            result = kv_move(old->block);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            result = kv_release(i);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    if(sKv.blockCount > LF_KV_MAX_BLOCKS)
+    {
+        // nothing could be moved
+        result = kv_release(sKv.blockCount - 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        return LF_RESULT_OUT_OF_MEMORY;
+    }
+
+    return result;
+}
+
+static lf_result_t kv_set_impl(uint16_t key, const void *value, size_t length)
+{
+    // validate args
+    LF_ASSERT(value == NULL && length != 0, LF_RESULT_INVALID_ARGS);
+    LF_ASSERT(length > LF_KV_VALUE_MAX || LF_KV_RECORD_SIZE(length) > (size_t)(LF_MEMORY_BLOCK_SIZE - LF_BLOCK_HEADER_SIZE), LF_RESULT_TOO_BIG_DATA_BATCH);
+
+    lf_result_t result = LF_RESULT_SUCCESS;
+    if(!sKv.loaded)
+    {
+        result = kv_load();
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+
+    kv_entry_t *entry = kv_find(key);
+    LF_ASSERT(entry == NULL, LF_RESULT_OUT_OF_MEMORY);
+
+    uint16_t size = LF_KV_RECORD_SIZE(length);
+    if(sKv.blockCount == 0 || sKv.blocks[sKv.blockCount - 1].end + size > LF_MEMORY_BLOCK_SIZE)
+    {
+        result = kv_open_block(size);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+
+    kv_block_t *log = &sKv.blocks[sKv.blockCount - 1];
+    uint16_t offset = log->end;
+    result = kv_append(key, (const uint8_t*)value, (uint8_t)length);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    kv_update(entry, key, log->block, offset, (uint8_t)length);
+    return result;
+}
+
+static lf_result_t kv_get_impl(uint16_t key, void *value, size_t size, size_t *length)
+{
+    // validate args
+    LF_ASSERT((value == NULL && size != 0) || length == NULL, LF_RESULT_INVALID_ARGS);
+
+    lf_result_t result = LF_RESULT_SUCCESS;
+    if(!sKv.loaded)
+    {
+        result = kv_load();
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+
+    kv_entry_t *entry = kv_find(key);
+    LF_ASSERT(entry == NULL || entry->block == LF_BLOCK_NONE, LF_RESULT_NOT_EXISTS);
+
+    *length = entry->length;
+    if(size > entry->length)
+    {
+        size = entry->length;
+    }
+    if(size == 0)
+    {
+        return result;
+    }
+    return app_read(entry->block, entry->offset + LF_KV_RECORD_HEADER_SIZE, value, size);
+}
+#endif
+
+#if LF_USE_TRANSACTIONS
+// marks the new version of the file as committed
+static lf_result_t mark_committed(uint16_t block)
+{
+    uint8_t flags;
+    lf_result_t result = app_read(block, LF_BLOCK_HEADER_SIZE, &flags, 1);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    // the flags are stored inverted
+    flags &= (uint8_t)~LF_FILE_FLAG_COMMITTED;
+    return app_write(block, LF_BLOCK_HEADER_SIZE, &flags, 1, 1);
+}
+
+// replaces the old versions of the keys of the transaction with the pending ones,
+// then erases the commit record
+static lf_result_t finish_commit(uint16_t record)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+
+    for(uint8_t key = 0; key <= LF_KEY_MAX; ++key)
+    {
+        if(!LF_TXN_HAS(key))
+        {
+            continue;
+        }
+
+        block_info_t pending;
+        result = findVersion(&pending, key, 0, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(pending.block == LF_BLOCK_NONE)
+        {
+            // already replaced before a reset
+            continue;
+        }
+
+        block_info_t old;
+        result = findBlock(&old, key, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(old.block != LF_BLOCK_NONE)
+        {
+            result = delete_chain(old.block, old.nextBlock);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+
+        result = mark_committed(pending.block);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+
+    return release_block(record);
+}
+
+// finishes the commit interrupted by a reset, or deletes the pending files
+static lf_result_t recover_transaction(void)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    uint16_t record = LF_BLOCK_NONE;
+
+    memset(&sTxn, 0, sizeof(sTxn));
+    for(uint16_t block = 0; block < LF_MEMORY_BLOCK_COUNT; ++block)
+    {
+        if(LF_IS_BAD(block))
+        {
+            continue;
+        }
+        uint8_t header[LF_BLOCK_LINK_SIZE];
+        result = app_read(block, 0, header, sizeof(header));
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(header[0] == LF_INFO_SYSTEM && (header[3] | (header[4] << 8)) == LF_SYSTEM_COMMIT)
+        {
+            record = block;
+        }
+        else if(header[0] != LF_KEY_FREE && (header[0] & LF_INFO_LEADING_MASK))
+        {
+            uint8_t pending;
+            result = is_pending(block, &pending);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            if(pending)
+            {
+                uint8_t key = header[0] & ~LF_INFO_LEADING_MASK;
+                sTxn.keys[key >> 3] |= (1u << (key & 7));
+            }
+        }
+    }
+
+    if(record != LF_BLOCK_NONE)
+    {
+        result = finish_commit(record);
+    }
+    else
+    {
+        for(uint8_t key = 0; key <= LF_KEY_MAX && result == LF_RESULT_SUCCESS; ++key)
+        {
+            if(LF_TXN_HAS(key))
+            {
+                block_info_t pending;
+                result = findVersion(&pending, key, 1, 1);
+                if(result == LF_RESULT_SUCCESS && pending.block != LF_BLOCK_NONE)
+                {
+                    result = delete_chain(pending.block, pending.nextBlock);
+                }
+            }
+        }
+    }
+
+    memset(&sTxn, 0, sizeof(sTxn));
+    return result;
+}
+
+static lf_result_t txn_begin_impl(void)
+{
+    LF_LOCK();
+    lf_result_t result = (sTxn.active || sEditMode == LF_MODE_WRITING) ? LF_RESULT_INVALID_STATE : LF_RESULT_SUCCESS;
+    if(result == LF_RESULT_SUCCESS)
+    {
+        memset(&sTxn, 0, sizeof(sTxn));
+        sTxn.active = 1;
+    }
+    LF_UNLOCK();
+    return result;
+}
+
+static lf_result_t txn_commit_impl(void)
+{
+    // the files of the transaction can not be written, read or deleted
+    LF_LOCK();
+    lf_result_t result = (!sTxn.active || sEditMode == LF_MODE_WRITING || sDeletedKey != LF_KEY_FREE) ? LF_RESULT_INVALID_STATE : LF_RESULT_SUCCESS;
+    for(uint8_t key = 0; key <= LF_KEY_MAX && result == LF_RESULT_SUCCESS; ++key)
+    {
+        if(LF_TXN_HAS(key) && is_open(key))
+        {
+            result = LF_RESULT_INVALID_STATE;
+        }
+    }
+    sTxn.committing = (result == LF_RESULT_SUCCESS);
+    LF_UNLOCK();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    // the commit record makes the new versions valid at once
+    uint16_t record;
+    result = allocateBlock(&record);
+    if(result == LF_RESULT_SUCCESS && record == LF_BLOCK_NONE)
+    {
+        result = LF_RESULT_OUT_OF_MEMORY;
+    }
+    if(result == LF_RESULT_SUCCESS)
+    {
+        uint8_t header[LF_BLOCK_LINK_SIZE] = {LF_INFO_SYSTEM, 0xff, 0xff, (uint8_t)LF_SYSTEM_COMMIT, (uint8_t)(LF_SYSTEM_COMMIT >> 8)};
+        result = app_write(record, 0, header, sizeof(header), 1);
+    }
+    if(result == LF_RESULT_SUCCESS)
+    {
+        // the transaction is complete, even if it is interrupted now
+        sTxn.active = 0;
+        result = finish_commit(record);
+    }
+
+    LF_LOCK();
+    sTxn.committing = 0;
+    LF_UNLOCK();
+    return result;
+}
+
+static lf_result_t txn_abort_impl(void)
+{
+    LF_ASSERT(!sTxn.active || sEditMode == LF_MODE_WRITING, LF_RESULT_INVALID_STATE);
+
+    lf_result_t result = LF_RESULT_SUCCESS;
+    for(uint8_t key = 0; key <= LF_KEY_MAX; ++key)
+    {
+        if(LF_TXN_HAS(key))
+        {
+            block_info_t pending;
+            result = findVersion(&pending, key, 1, 1);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            if(pending.block != LF_BLOCK_NONE)
+            {
+                result = delete_chain(pending.block, pending.nextBlock);
+                LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            }
+        }
+    }
+
+    sTxn.active = 0;
+    return result;
+}
+#endif
+
+#if LF_USE_OVERWRITE || LF_USE_COPY
+// allocates the first block of the new chain and the block of a swap record, both are kept from
+// the other allocations as the written blocks until their headers are programmed
+static lf_result_t allocate_swap(uint16_t *record, uint16_t *newBlock)
+{
+    lf_result_t result = allocate_written(newBlock, LF_BLOCK_NONE);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    return allocate_written(record, *newBlock);
+}
+
+// programs the record of the chain from 'newBlock' replacing the chain from 'oldBlock', both chains
+// end with the blocks from 'join'. The header is programmed last, so only complete records are found.
+static lf_result_t write_swap(uint16_t record, uint16_t oldBlock, uint16_t newBlock, uint16_t join)
+{
+    uint16_t entry[3] = {oldBlock, newBlock, join};
+    lf_result_t result = app_write(record, LF_BLOCK_HEADER_SIZE, entry, sizeof(entry), 1);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    uint8_t header[LF_BLOCK_LINK_SIZE] = {LF_INFO_SYSTEM, 0xff, 0xff, (uint8_t)LF_SYSTEM_SWAP, (uint8_t)(LF_SYSTEM_SWAP >> 8)};
+    return app_write(record, 0, header, sizeof(header), 1);
+}
+
+// erases the blocks of the chain from 'block' up to 'join', the chain ends early on a block without a header.
+// The blocks are erased from the end of the chain, so after a reset the rest is still reached from 'block'.
+static lf_result_t release_chain(uint16_t block, uint16_t join)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    for(uint8_t first = 1; block != join && block < LF_MEMORY_BLOCK_COUNT; first = 0)
+    {
+        // the last blocks of the chain are kept, the ones before are erased in the next passes
+        uint16_t last[LF_STACK_BUFFER_SIZE / 2];
+        uint16_t count = 0;
+        uint16_t current = block;
+        for(uint16_t steps = 0; steps < LF_MEMORY_BLOCK_COUNT; ++steps)
+        {
+            uint8_t header[LF_BLOCK_LINK_SIZE];
+            result = app_read(current, 0, header, sizeof(header));
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            if(header[0] == LF_KEY_FREE && !first)
+            {
+                // erased in the previous pass
+                break;
+            }
+            last[count++ % LF_CHAIN_WINDOW] = current;
+            if(header[0] == LF_KEY_FREE)
+            {
+                break;
+            }
+            current = *((uint16_t*)(header+1));
+            if(current == join || current >= LF_MEMORY_BLOCK_COUNT)
+            {
+                break;
+            }
+        }
+
+        uint16_t kept = (count < LF_CHAIN_WINDOW) ? count : LF_CHAIN_WINDOW;
+        for(uint16_t i = 1; i <= kept; ++i)
+        {
+            result = release_block(last[(uint16_t)(count - i) % LF_CHAIN_WINDOW]);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+        if(count <= LF_CHAIN_WINDOW)
+        {
+            break;
+        }
+    }
+    return result;
+}
+
+// demotes the old leading block, which makes the new chain the file, then erases the old chain up to
+// the shared blocks and the record. The leading block is erased last, so lf_init resumes an interrupted erasing.
+static lf_result_t finish_swap(uint16_t record, uint16_t oldBlock, uint16_t join)
+{
+    uint8_t header[LF_BLOCK_LINK_SIZE];
+    lf_result_t result = app_read(oldBlock, 0, header, sizeof(header));
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    if(header[0] != LF_KEY_FREE)
+    {
+        uint8_t info = header[0] & ~LF_INFO_LEADING_MASK;
+        result = app_write(oldBlock, 0, &info, 1, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        result = release_chain(*((uint16_t*)(header+1)), join);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        result = release_block(oldBlock);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+    return release_block(record);
+}
+
+// erases the new chain up to the shared blocks and the record, the old chain stays the file
+static lf_result_t abort_swap(uint16_t record, uint16_t newBlock, uint16_t join)
+{
+    lf_result_t result = release_chain(newBlock, join);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    return release_block(record);
+}
+
+// completes the swap interrupted by a reset: finished if the old leading block was demoted, otherwise undone
+static lf_result_t recover_swap(void)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    for(uint16_t record = 0; record < LF_MEMORY_BLOCK_COUNT && result == LF_RESULT_SUCCESS; ++record)
+    {
+        if(LF_IS_BAD(record))
+        {
+            continue;
+        }
+        uint8_t header[LF_BLOCK_LINK_SIZE];
+        result = app_read(record, 0, header, sizeof(header));
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(header[0] != LF_INFO_SYSTEM || (header[3] | (header[4] << 8)) != LF_SYSTEM_SWAP)
+        {
+            continue;
+        }
+
+        uint16_t entry[3];
+        result = app_read(record, LF_BLOCK_HEADER_SIZE, entry, sizeof(entry));
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(entry[0] >= LF_MEMORY_BLOCK_COUNT || entry[1] >= LF_MEMORY_BLOCK_COUNT)
+        {
+            result = release_block(record);
+            continue;
+        }
+        uint8_t info;
+        result = app_read(entry[0], 0, &info, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        if(info != LF_KEY_FREE && (info & LF_INFO_LEADING_MASK))
+        {
+            result = abort_swap(record, entry[1], entry[2]);
+        }
+        else
+        {
+            result = finish_swap(record, entry[0], entry[2]);
+        }
+    }
+    return result;
+}
+#endif
+
+#if LF_USE_OVERWRITE
+// starts the modification of the saved file, no other file can be written then
+static lf_result_t start_edit(uint8_t key, block_info_t *file)
+{
+    LF_ASSERT(key > LF_KEY_MAX, LF_RESULT_INVALID_ARGS);
+
+    LF_LOCK();
+    lf_result_t result = start_writing(key);
+    LF_UNLOCK();
+    // the file is open
+    LF_ASSERT(result == LF_RESULT_ALREADY_EXISTS, LF_RESULT_INVALID_STATE);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    result = findBlock(file, key, 1);
+    if(result == LF_RESULT_SUCCESS && file->block == LF_BLOCK_NONE)
+    {
+        result = LF_RESULT_NOT_EXISTS;
+    }
+#if LF_USE_COMPRESSION
+    if(result == LF_RESULT_SUCCESS)
+    {
+        // the stored data of a compressed file does not match its content
+        uint8_t flags;
+        result = app_read(file->block, LF_BLOCK_HEADER_SIZE, &flags, 1);
+        if(result == LF_RESULT_SUCCESS && ((uint8_t)~flags & LF_FILE_FLAG_COMPRESSED))
+        {
+            result = LF_RESULT_INVALID_ARGS;
+        }
+    }
+#endif
+    if(result != LF_RESULT_SUCCESS)
+    {
+        LF_LOCK();
+        sEditMode = LF_MODE_NONE;
+        LF_UNLOCK();
+    }
+    return result;
+}
+
+static lf_result_t end_edit(lf_result_t result)
+{
+    LF_LOCK();
+    sEditMode = LF_MODE_NONE;
+    LF_UNLOCK();
+    return result;
+}
+
+// finds the first block of the file which ends at 'offset' or later, 'end' is the offset of its end
+static lf_result_t locate_offset(const block_info_t *file, uint32_t offset, block_info_t *info, uint32_t *end)
+{
+    *info = *file;
+    *end = file->size;
+    while(*end < offset)
+    {
+        LF_ASSERT(info->nextBlock == LF_BLOCK_NONE, LF_RESULT_END_OF_FILE);
+        info->block = info->nextBlock;
+        uint16_t header[2];
+        lf_result_t result = app_read(info->block, 1, header, 4);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        info->nextBlock = header[0];
+        info->size = header[1];
+        *end += info->size;
+    }
+    return LF_RESULT_SUCCESS;
+}
+
+// copies 'length' bytes of the stored data from the reader to the written file
+static lf_result_t copy_stored(lf_reader *reader, uint32_t length)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    while(length > 0)
+    {
+        uint8_t buffer[LF_STACK_BUFFER_SIZE];
+        size_t toCopySize = (length > LF_STACK_BUFFER_SIZE) ? LF_STACK_BUFFER_SIZE : length;
+        size_t readLength = 0;
+        result = read_stored(reader, buffer, toCopySize, &readLength);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        result = write_data(buffer, toCopySize);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        length -= toCopySize;
+    }
+    return result;
+}
+
+// writes a new chain from 'sFirstBlock' with the first 'end' bytes of the file, 'length' bytes from
+// 'offset' replaced with 'data', and links it to 'nextBlock'
+static lf_result_t write_version(const block_info_t *file, uint32_t end, uint32_t offset, const uint8_t *data, size_t length, uint16_t nextBlock)
+{
+    uint8_t header[LF_LEADING_HEADER_SIZE];
+    lf_result_t result = app_read(file->block, 0, header, LF_LEADING_HEADER_SIZE);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    // the new version keeps the attributes, so the blocks are filled as the old ones
+    sFlags = 0;
+    sContentSize = end;
+#if LF_USE_FILE_ATTRIBUTES
+    sFlags = (uint8_t)~header[LF_BLOCK_HEADER_SIZE];
+    if(nextBlock != LF_BLOCK_NONE)
+    {
+        sContentSize = *((uint32_t*)(header+LF_BLOCK_HEADER_SIZE+1));
+    }
+#endif
+#if LF_USE_RECORDS
+    sRecordSize = *((uint16_t*)(header+LF_BLOCK_HEADER_SIZE+5));
+    if(sRecordSize == LF_RECORD_SIZE_NONE)
+    {
+        sRecordSize = 0;
+    }
+#endif
+
+    sCurrentBlock = sFirstBlock;
+    sCursor = 0;
+#if LF_USE_CRC
+    sCrc = 0;
+#endif
+
+    lf_reader old;
+    reader_start(&old, file->block, header);
+    result = copy_stored(&old, offset);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    if(length != 0)
+    {
+        size_t readLength = 0;
+        result = read_stored(&old, NULL, length, &readLength);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        result = write_data((void*)data, length);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+    result = copy_stored(&old, end - offset - length);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    sNextBlock = nextBlock;
+    result = save_current_block();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+#if LF_USE_FILE_ATTRIBUTES
+    // the leading block was saved before the content size was known
+    if(sCurrentBlock != sFirstBlock || nextBlock != LF_BLOCK_NONE)
+    {
+        result = app_write(sFirstBlock, LF_BLOCK_HEADER_SIZE + 1, &sContentSize, 4, 1);
+    }
+#endif
+    return result;
+}
+
+// replaces the file with a new version sharing the blocks from 'nextBlock', a swap record lets
+// lf_init finish or undo the replacement if it is interrupted
+static lf_result_t copy_version(const block_info_t *file, uint32_t end, uint32_t offset, const uint8_t *data, size_t length, uint16_t nextBlock)
+{
+    uint16_t record;
+    lf_result_t result = allocate_swap(&record, &sFirstBlock);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    result = write_swap(record, file->block, sFirstBlock, nextBlock);
+    if(result == LF_RESULT_SUCCESS)
+    {
+        result = write_version(file, end, offset, data, length, nextBlock);
+    }
+    if(result != LF_RESULT_SUCCESS)
+    {
+        abort_swap(record, sFirstBlock, nextBlock);
+        return result;
+    }
+    return finish_swap(record, file->block, nextBlock);
+}
+
+static lf_result_t truncate_file(const block_info_t *file, uint32_t length)
+{
+    block_info_t last;
+    uint32_t end;
+    lf_result_t result = locate_offset(file, length, &last, &end);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    if(end == length && last.nextBlock == LF_BLOCK_NONE)
+    {
+        // nothing to cut off
+        return result;
+    }
+
+#if !LF_USE_CRC
+    if(LF_MEMORY_REWRITABLE)
+    {
+        // the header of the new last block is overwritten, then the blocks behind it are freed
+        uint16_t link[2] = {LF_BLOCK_NONE, (uint16_t)(last.size - (end - length))};
+        result = app_write(last.block, 1, link, 4, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+#if LF_USE_FILE_ATTRIBUTES
+        result = app_write(file->block, LF_BLOCK_HEADER_SIZE + 1, &length, 4, 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+#endif
+        if(last.nextBlock == LF_BLOCK_NONE)
+        {
+            return result;
+        }
+        uint16_t nextBlock;
+        result = app_read(last.nextBlock, 1, &nextBlock, 2);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        return delete_chain(last.nextBlock, nextBlock);
+    }
+#endif
+
+    // the links can not be reprogrammed, so the kept part is copied
+    return copy_version(file, length, length, NULL, 0, LF_BLOCK_NONE);
+}
+
+static lf_result_t overwrite_file(const block_info_t *file, uint32_t offset, const uint8_t *data, size_t length)
+{
+    block_info_t last;
+    uint32_t end;
+    lf_result_t result = locate_offset(file, offset + length, &last, &end);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    if(length == 0)
+    {
+        return result;
+    }
+
+#if !LF_USE_CRC
+    // programmed in place if only bits are cleared, first checked in all the blocks
+    for(uint8_t program = 0; program < 2; ++program)
+    {
+        block_info_t info = *file;
+        uint32_t start = 0;
+        uint32_t position = offset;
+        while(position < offset + length)
+        {
+            if(position < start + info.size)
+            {
+                uint16_t blockOffset = LF_DATA_OFFSET(info.block == file->block) + (uint16_t)(position - start);
+                size_t toSaveSize = start + info.size - position;
+                if(toSaveSize > offset + length - position)
+                {
+                    toSaveSize = offset + length - position;
+                }
+                const uint8_t *content = data + (position - offset);
+                result = program ? program_direct(info.block, blockOffset, content, toSaveSize) : can_program(info.block, blockOffset, content, toSaveSize);
+                if(result == LF_RESULT_INVALID_STATE)
+                {
+                    break;
+                }
+                LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+                position += toSaveSize;
+            }
+            if(position == offset + length)
+            {
+                break;
+            }
+
+            start += info.size;
+            uint16_t header[2];
+            info.block = info.nextBlock;
+            result = app_read(info.block, 1, header, 4);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+            info.nextBlock = header[0];
+            info.size = header[1];
+        }
+        if(result == LF_RESULT_INVALID_STATE)
+        {
+            break;
+        }
+        if(program)
+        {
+            return result;
+        }
+    }
+#endif
+
+    // copy-on-write of the blocks up to the last changed one, the ones behind it are shared
+    return copy_version(file, end, offset, data, length, last.nextBlock);
+}
+
+static lf_result_t truncate_impl(uint8_t key, uint32_t length)
+{
+    block_info_t file;
+    lf_result_t result = start_edit(key, &file);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    return end_edit(truncate_file(&file, length));
+}
+
+static lf_result_t overwrite_impl(uint8_t key, uint32_t offset, const void *data, size_t length)
+{
+    LF_ASSERT(data == NULL && length != 0, LF_RESULT_INVALID_ARGS);
+
+    block_info_t file;
+    lf_result_t result = start_edit(key, &file);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    return end_edit(overwrite_file(&file, offset, (const uint8_t*)data, length));
+}
+#endif
+
+#if LF_USE_COPY
+// copies the stored bytes of the block 'from' to the same place in the block 'to', continuing the 'crc' if not NULL
+static lf_result_t copy_block_data(uint16_t from, uint16_t to, uint16_t offset, uint16_t length, uint32_t *crc)
+{
+    lf_result_t result = LF_RESULT_SUCCESS;
+    uint8_t buffer[LF_COPY_BUFFER_SIZE];
+    while(length > 0)
+    {
+        // the transfers are aligned to the buffer size, so they do not cross more pages than needed
+        uint16_t toCopySize = LF_COPY_BUFFER_SIZE - (offset % LF_COPY_BUFFER_SIZE);
+        if(toCopySize > length)
+        {
+            toCopySize = length;
+        }
+        result = app_read(from, offset, buffer, toCopySize);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+#if LF_USE_CRC
+        if(crc != NULL)
+        {
+            *crc = crc32(*crc, buffer, toCopySize);
+        }
+#else
+        (void)crc;
+#endif
+        result = program_direct(to, offset, buffer, toCopySize);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        offset += toCopySize;
+        length -= toCopySize;
+    }
+    return result;
+}
+
+// copies the chain starting on the leading 'block' to the chain of the written file, block by block
+static lf_result_t copy_chain(uint16_t block, uint8_t key)
+{
+    uint8_t header[LF_LEADING_HEADER_SIZE];
+    lf_result_t result = app_read(block, 0, header, LF_LEADING_HEADER_SIZE);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    uint16_t to = sFirstBlock;
+    uint8_t leading = 1;
+    while(1)
+    {
+        uint16_t nextBlock = *((uint16_t*)(header+1));
+        uint16_t size = *((uint16_t*)(header+3));
+        uint32_t crc = 0;
+        result = copy_block_data(block, to, LF_DATA_OFFSET(leading), size, &crc);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+        uint16_t newNextBlock = LF_BLOCK_NONE;
+        if(nextBlock != LF_BLOCK_NONE)
+        {
+            // the copied block is kept from the other allocations until its header is programmed
+            result = allocate_written(&newNextBlock, to);
+            LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+        }
+
+        // the attributes of the leading block are copied as they are
+        header[0] = leading ? (key | LF_INFO_LEADING_MASK) : key;
+        *((uint16_t*)(header+1)) = newNextBlock;
+#if LF_USE_CRC
+        *((uint32_t*)(header+LF_BLOCK_LINK_SIZE)) = crc_block(crc, newNextBlock, size);
+#endif
+        result = app_write(to, 0, header, LF_DATA_OFFSET(leading), 1);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+        if(nextBlock == LF_BLOCK_NONE)
+        {
+            return result;
+        }
+        block = nextBlock;
+        to = newNextBlock;
+        leading = 0;
+        result = app_read(block, 0, header, LF_BLOCK_HEADER_SIZE);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+}
+
+static lf_result_t copy_impl(uint8_t key, uint8_t newKey)
+{
+    // validate args
+    LF_ASSERT(key > LF_KEY_MAX || newKey > LF_KEY_MAX || key == newKey, LF_RESULT_INVALID_ARGS);
+#if LF_USE_TRANSACTIONS
+    LF_ASSERT(sTxn.active, LF_RESULT_INVALID_STATE);
+#endif
+
+    block_info_t file;
+    lf_result_t result = findBlock(&file, key, 0);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(file.block == LF_BLOCK_NONE, LF_RESULT_NOT_EXISTS);
+
+    // the copy is written as a new file, the source is kept open meanwhile
+    lf_reader source;
+    LF_LOCK();
+    result = start_writing(newKey);
+    if(result == LF_RESULT_SUCCESS)
+    {
+        result = add_reader(&source, key);
+        if(result != LF_RESULT_SUCCESS)
+        {
+            sEditMode = LF_MODE_NONE;
+        }
+    }
+    LF_UNLOCK();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    // the file could be deleted before the reader was added
+    uint8_t info;
+    result = app_read(file.block, 0, &info, 1);
+    if(result == LF_RESULT_SUCCESS && info != (key | LF_INFO_LEADING_MASK))
+    {
+        result = LF_RESULT_NOT_EXISTS;
+    }
+    if(result == LF_RESULT_SUCCESS)
+    {
+        result = find_new_file(newKey);
+    }
+    if(result == LF_RESULT_SUCCESS)
+    {
+        result = copy_chain(file.block, newKey);
+    }
+
+    LF_LOCK();
+    remove_reader(&source);
+    sEditMode = LF_MODE_NONE;
+    LF_UNLOCK();
+    return result;
+}
+
+static lf_result_t rename_file(uint8_t key, uint8_t newKey)
+{
+    block_info_t file;
+    lf_result_t result = findBlock(&file, newKey, 0);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(file.block != LF_BLOCK_NONE, LF_RESULT_ALREADY_EXISTS);
+    result = findBlock(&file, key, 1);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    LF_ASSERT(file.block == LF_BLOCK_NONE, LF_RESULT_NOT_EXISTS);
+
+    // the key is changed in place if only bits are cleared, the key of the following blocks is not used
+    uint8_t info = newKey | LF_INFO_LEADING_MASK;
+    if(LF_MEMORY_REWRITABLE || (info & (key | LF_INFO_LEADING_MASK)) == info)
+    {
+        return app_write(file.block, 0, &info, 1, 1);
+    }
+
+    // otherwise only the leading block is copied, the copy shares the following blocks
+    uint8_t header[LF_LEADING_HEADER_SIZE];
+    result = app_read(file.block, 0, header, LF_LEADING_HEADER_SIZE);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    uint16_t record, copy;
+    result = allocate_swap(&record, &copy);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    result = write_swap(record, file.block, copy, file.nextBlock);
+    if(result == LF_RESULT_SUCCESS)
+    {
+        result = copy_block_data(file.block, copy, LF_LEADING_HEADER_SIZE, file.size, NULL);
+    }
+    if(result == LF_RESULT_SUCCESS)
+    {
+        header[0] = info;
+        result = app_write(copy, 0, header, LF_LEADING_HEADER_SIZE, 1);
+    }
+    if(result != LF_RESULT_SUCCESS)
+    {
+        abort_swap(record, copy, file.nextBlock);
+        return result;
+    }
+    return finish_swap(record, file.block, file.nextBlock);
+}
+
+static lf_result_t rename_impl(uint8_t key, uint8_t newKey)
+{
+    // validate args
+    LF_ASSERT(key > LF_KEY_MAX || newKey > LF_KEY_MAX || key == newKey, LF_RESULT_INVALID_ARGS);
+#if LF_USE_TRANSACTIONS
+    LF_ASSERT(sTxn.active, LF_RESULT_INVALID_STATE);
+#endif
+
+    // the old key can not be open, the new one is written
+    LF_LOCK();
+    lf_result_t result = start_writing(newKey);
+    if(result == LF_RESULT_SUCCESS)
+    {
+        result = start_deleting(key);
+        if(result != LF_RESULT_SUCCESS)
+        {
+            sEditMode = LF_MODE_NONE;
+        }
+    }
+    LF_UNLOCK();
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    result = rename_file(key, newKey);
+
+    LF_LOCK();
+    sEditMode = LF_MODE_NONE;
+    sDeletedKey = LF_KEY_FREE;
+    LF_UNLOCK();
+    return result;
+}
+#endif
+
+#if LF_USE_RECORDS
+static lf_result_t create_records_impl(uint8_t key, uint16_t recordSize)
+{
+    LF_ASSERT(recordSize == 0 || recordSize == LF_RECORD_SIZE_NONE || recordSize > LF_MEMORY_BLOCK_SIZE - LF_LEADING_HEADER_SIZE, LF_RESULT_INVALID_ARGS);
+
+    lf_result_t result = create_impl(key);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    sRecordSize = recordSize;
+    return result;
+}
+
+// caches the chain of the blocks, so each record is accessed with a single driver call
+static lf_result_t load_chain(lf_records *file, uint16_t *chain, uint16_t chainLength)
+{
+    uint8_t attributes[6];
+    lf_result_t result = app_read(file->reader.currentBlock, LF_BLOCK_HEADER_SIZE + 1, attributes, sizeof(attributes));
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    uint32_t contentSize = *((uint32_t*)(attributes));
+    uint16_t recordSize = *((uint16_t*)(attributes+4));
+    LF_ASSERT(contentSize == LF_SIZE_UNKNOWN, LF_RESULT_NOT_EXISTS);
+    LF_ASSERT(recordSize == LF_RECORD_SIZE_NONE || recordSize == 0, LF_RESULT_INVALID_ARGS);
+
+    file->recordSize = recordSize;
+    file->count = contentSize / recordSize;
+    file->leadingCount = (LF_MEMORY_BLOCK_SIZE - LF_LEADING_HEADER_SIZE) / recordSize;
+    file->blockCount = (LF_MEMORY_BLOCK_SIZE - LF_BLOCK_HEADER_SIZE) / recordSize;
+    file->chain = chain;
+
+    uint32_t blocks = 1;
+    if(file->count > file->leadingCount)
+    {
+        blocks += (file->count - file->leadingCount + file->blockCount - 1) / file->blockCount;
+    }
+    LF_ASSERT(blocks > chainLength, LF_RESULT_OUT_OF_MEMORY);
+
+    chain[0] = file->reader.currentBlock;
+    uint16_t block = file->reader.nextBlock;
+    for(uint16_t i = 1; i < blocks; ++i)
+    {
+        LF_ASSERT(block == LF_BLOCK_NONE, LF_RESULT_CORRUPTED);
+        chain[i] = block;
+        result = app_read(block, 1, &block, 2);
+        LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+    }
+
+    return result;
+}
+
+static lf_result_t records_open_impl(lf_records *file, uint8_t key, uint16_t *chain, uint16_t chainLength)
+{
+    LF_ASSERT(file == NULL || chain == NULL || chainLength == 0, LF_RESULT_INVALID_ARGS);
+
+    lf_result_t result = reader_open_impl(&file->reader, key, NULL, 0);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    result = load_chain(file, chain, chainLength);
+    if(result != LF_RESULT_SUCCESS)
+    {
+        reader_close_impl(&file->reader);
+    }
+    return result;
+}
+
+// position of the record in the memory
+static void locate_record(lf_records *file, uint32_t index, uint16_t *block, uint16_t *offset)
+{
+    if(index < file->leadingCount)
+    {
+        *block = file->chain[0];
+        *offset = LF_LEADING_HEADER_SIZE + (uint16_t)index * file->recordSize;
+        return;
+    }
+    index -= file->leadingCount;
+    *block = file->chain[1 + index / file->blockCount];
+    *offset = LF_BLOCK_HEADER_SIZE + (uint16_t)(index % file->blockCount) * file->recordSize;
+}
+
+static lf_result_t read_record_impl(lf_records *file, uint32_t index, void *record)
+{
+    LF_ASSERT(file == NULL || !file->reader.open, LF_RESULT_INVALID_STATE);
+    LF_ASSERT(record == NULL, LF_RESULT_INVALID_ARGS);
+    LF_ASSERT(index >= file->count, LF_RESULT_END_OF_FILE);
+
+    uint16_t block, offset;
+    locate_record(file, index, &block, &offset);
+    return app_read(block, offset, record, file->recordSize);
+}
+
+static lf_result_t write_record_impl(lf_records *file, uint32_t index, const void *record)
+{
+    LF_ASSERT(file == NULL || !file->reader.open, LF_RESULT_INVALID_STATE);
+    LF_ASSERT(record == NULL, LF_RESULT_INVALID_ARGS);
+    LF_ASSERT(index >= file->count, LF_RESULT_END_OF_FILE);
+#if LF_USE_CRC
+    // the CRC of the block can not be updated
+    return LF_RESULT_INVALID_STATE;
+#else
+    uint16_t block, offset;
+    locate_record(file, index, &block, &offset);
+
+    // programming can only clear bits, e.g. fill a record left erased
+    lf_result_t result = can_program(block, offset, record, file->recordSize);
+    LF_ASSERT(result != LF_RESULT_SUCCESS, result);
+
+    return program_direct(block, offset, record, file->recordSize);
+#endif
+}
+#endif
+
+// reads the memory, then finishes or undoes the operations interrupted by a reset
+static lf_result_t init_recover_impl(void)
+{
+    lf_result_t result = init_impl();
+#if LF_USE_OVERWRITE || LF_USE_COPY
+    if(result == LF_RESULT_SUCCESS)
+    {
+        result = recover_swap();
+    }
+#endif
+#if LF_USE_TRANSACTIONS
+    if(result == LF_RESULT_SUCCESS)
+    {
+        result = recover_transaction();
+    }
+#endif
+    return result;
+}
+
+#if LF_USE_WORKSPACE
+static lf_result_t mount_impl(void *workspace, size_t size, lf_workspace_sizes *sizes)
+{
+    lf_workspace_sizes needed;
+    workspace_sizes(&needed);
+    if(sizes != NULL)
+    {
+        *sizes = needed;
+    }
+    if(workspace == NULL)
+    {
+        return LF_RESULT_SUCCESS;
+    }
+    LF_ASSERT(((uintptr_t)workspace & 3) != 0, LF_RESULT_INVALID_ARGS);
+    LF_ASSERT(size < needed.required, LF_RESULT_OUT_OF_MEMORY);
+
+    sWorkspace.ptr = (uint8_t*)workspace;
+    sWorkspace.size = size;
+    return init_recover_impl();
+}
+#endif
+
+// ---------------- API ----------------
+lf_result_t lf_init(void)
+{
+    LF_TRACE_RETURN(LF_TRACE_INIT, init_recover_impl());
+}
+
+#if LF_USE_WORKSPACE
+lf_result_t lf_mount(void *workspace, size_t size, lf_workspace_sizes *sizes)
+{
+    LF_TRACE_RETURN(LF_TRACE_MOUNT, mount_impl(workspace, size, sizes));
+}
+#endif
+
+lf_result_t lf_exists(uint8_t key)
+{
+    LF_TRACE_RETURN(LF_TRACE_EXISTS, exists_impl(key));
+}
+
+lf_result_t lf_size(uint8_t key, uint32_t *size)
+{
+    LF_TRACE_RETURN(LF_TRACE_SIZE, size_impl(key, size));
+}
+
+lf_result_t lf_create(uint8_t key)
+{
+    LF_TRACE_RETURN(LF_TRACE_CREATE, create_impl(key));
+}
+
+lf_result_t lf_write(void *content, size_t length)
+{
+    LF_TRACE_RETURN(LF_TRACE_WRITE, write_impl(content, length));
+}
+
+lf_result_t lf_save(void)
+{
+    LF_TRACE_RETURN(LF_TRACE_SAVE, save_impl());
+}
+
+lf_result_t lf_open(uint8_t key)
+{
+    LF_TRACE_RETURN(LF_TRACE_OPEN, open_impl(key, NULL, 0));
+}
+
+lf_result_t lf_read(void *content, size_t length)
+{
+    LF_TRACE_RETURN(LF_TRACE_READ, read_impl(&sReader, content, length));
+}
+
+lf_result_t lf_read_some(void *content, size_t length, size_t *readLength)
+{
+    LF_TRACE_RETURN(LF_TRACE_READ_SOME, read_some_impl(&sReader, content, length, readLength));
+}
+
+#if LF_USE_MAP
+lf_result_t lf_read_direct(const void **content, size_t *length)
+{
+    LF_TRACE_RETURN(LF_TRACE_READ_DIRECT, read_direct_impl(content, length));
+}
+#endif
+
+lf_result_t lf_close(void)
+{
+    LF_TRACE_RETURN(LF_TRACE_CLOSE, close_impl());
+}
+
+lf_result_t lf_delete(uint8_t key)
+{
+    LF_TRACE_RETURN(LF_TRACE_DELETE, delete_impl(key));
+}
+
+lf_result_t lf_format(void)
+{
+    LF_TRACE_RETURN(LF_TRACE_FORMAT, format_impl());
+}
+
+lf_result_t lf_reader_open(lf_reader *reader, uint8_t key)
+{
+    LF_TRACE_RETURN(LF_TRACE_READER_OPEN, reader_open_impl(reader, key, NULL, 0));
+}
+
+lf_result_t lf_reader_read(lf_reader *reader, void *content, size_t length)
+{
+    LF_TRACE_RETURN(LF_TRACE_READER_READ, read_impl(reader, content, length));
+}
+
+lf_result_t lf_reader_read_some(lf_reader *reader, void *content, size_t length, size_t *readLength)
+{
+    LF_TRACE_RETURN(LF_TRACE_READER_READ_SOME, read_some_impl(reader, content, length, readLength));
+}
+
+lf_result_t lf_reader_close(lf_reader *reader)
+{
+    LF_TRACE_RETURN(LF_TRACE_READER_CLOSE, reader_close_impl(reader));
+}
+
+#if LF_USE_COMPRESSION
+lf_result_t lf_create_compressed(uint8_t key, void *workspace, size_t size)
+{
+    LF_TRACE_RETURN(LF_TRACE_CREATE_COMPRESSED, create_compressed_impl(key, workspace, size));
+}
+
+lf_result_t lf_open_compressed(uint8_t key, void *workspace, size_t size)
+{
+    LF_TRACE_RETURN(LF_TRACE_OPEN_COMPRESSED, open_impl(key, workspace, size));
+}
+
+lf_result_t lf_reader_open_compressed(lf_reader *reader, uint8_t key, void *workspace, size_t size)
+{
+    LF_TRACE_RETURN(LF_TRACE_READER_OPEN_COMPRESSED, reader_open_impl(reader, key, workspace, size));
+}
+#endif
+
+#if LF_USE_KV
+lf_result_t lf_kv_set(uint16_t key, const void *value, size_t length)
+{
+    LF_TRACE_RETURN(LF_TRACE_KV_SET, kv_set_impl(key, value, length));
+}
+
+lf_result_t lf_kv_get(uint16_t key, void *value, size_t size, size_t *length)
+{
+    LF_TRACE_RETURN(LF_TRACE_KV_GET, kv_get_impl(key, value, size, length));
+}
+#endif
+
+#if LF_USE_TAIL
+lf_result_t lf_reader_follow(lf_reader *reader, uint8_t key)
+{
+    LF_TRACE_RETURN(LF_TRACE_READER_FOLLOW, reader_follow_impl(reader, key));
+}
+
+lf_result_t lf_reader_wait(lf_reader *reader)
+{
+    LF_TRACE_RETURN(LF_TRACE_READER_WAIT, reader_wait_impl(reader));
+}
+#endif
+
+#if LF_USE_TRANSACTIONS
+lf_result_t lf_txn_begin(void)
+{
+    LF_TRACE_RETURN(LF_TRACE_TXN_BEGIN, txn_begin_impl());
+}
+
+lf_result_t lf_txn_commit(void)
+{
+    LF_TRACE_RETURN(LF_TRACE_TXN_COMMIT, txn_commit_impl());
+}
+
+lf_result_t lf_txn_abort(void)
+{
+    LF_TRACE_RETURN(LF_TRACE_TXN_ABORT, txn_abort_impl());
+}
+#endif
+
+#if LF_USE_OVERWRITE
+lf_result_t lf_truncate(uint8_t key, uint32_t length)
+{
+    LF_TRACE_RETURN(LF_TRACE_TRUNCATE, truncate_impl(key, length));
+}
+
+lf_result_t lf_overwrite(uint8_t key, uint32_t offset, const void *data, size_t length)
+{
+    LF_TRACE_RETURN(LF_TRACE_OVERWRITE, overwrite_impl(key, offset, data, length));
+}
+#endif
+
+#if LF_USE_COPY
+lf_result_t lf_rename(uint8_t key, uint8_t newKey)
+{
+    LF_TRACE_RETURN(LF_TRACE_RENAME, rename_impl(key, newKey));
+}
+
+lf_result_t lf_copy(uint8_t key, uint8_t newKey)
+{
+    LF_TRACE_RETURN(LF_TRACE_COPY, copy_impl(key, newKey));
+}
+#endif
+
+#if LF_USE_RECORDS
+lf_result_t lf_create_records(uint8_t key, uint16_t recordSize)
+{
+    LF_TRACE_RETURN(LF_TRACE_CREATE_RECORDS, create_records_impl(key, recordSize));
+}
+
+lf_result_t lf_records_open(lf_records *file, uint8_t key, uint16_t *chain, uint16_t chainLength)
+{
+    LF_TRACE_RETURN(LF_TRACE_RECORDS_OPEN, records_open_impl(file, key, chain, chainLength));
+}
+
+lf_result_t lf_read_record(lf_records *file, uint32_t index, void *record)
+{
+    LF_TRACE_RETURN(LF_TRACE_READ_RECORD, read_record_impl(file, index, record));
+}
+
+lf_result_t lf_write_record(lf_records *file, uint32_t index, const void *record)
+{
+    LF_TRACE_RETURN(LF_TRACE_WRITE_RECORD, write_record_impl(file, index, record));
+}
+
+lf_result_t lf_records_close(lf_records *file)
+{
+    LF_TRACE_RETURN(LF_TRACE_RECORDS_CLOSE, reader_close_impl((file != NULL) ? &file->reader : NULL));
+}
+#endif
+
+#if LF_USE_STATS
+void lf_get_stats(lf_stats *stats)
+{
+    *stats = sStats;
+}
+
+void lf_reset_stats(void)
+{
+    memset(&sStats, 0, sizeof(sStats));
+}
+#endif
+
+#if LF_USE_TRACE
+void lf_set_trace(lf_trace_callback callback)
+{
+    sTrace = callback;
+}
+#endif
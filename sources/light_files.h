@@ -43,22 +43,350 @@ typedef enum {
     LF_RESULT_TOO_MUCH_TO_READ,
     LF_RESULT_INVALID_CONFIG,
     LF_RESULT_INVALID_STATE,
-    LF_RESULT_END_OF_FILE
+    LF_RESULT_END_OF_FILE,
+    LF_RESULT_CORRUPTED,
+    LF_RESULT_NO_DATA, // a followed file has no more data yet
+    LF_RESULT_BAD_BLOCK // returned by the driver when the device reports a failed program or erase
 } lf_result_t;
 
+// memory capabilities
+#define LF_MEMORY_FLAG_REWRITABLE (0x01) // each byte can be overwritten without erasing (EEPROM, FRAM)
+
 typedef struct {
     uint16_t blockCount;
     uint16_t blockSize;
+    uint16_t pageSize; // program page size, 0 if the memory has no page boundaries
+    uint8_t flags; // LF_MEMORY_FLAG_* values
+    uint8_t deviceCount; // devices the blocks are striped across (LF_USE_STRIPING), 1 by default
 } lf_memory_config;
 
+// The geometry of the memory can be fixed at compile time by defining LF_BLOCK_SIZE,
+// LF_BLOCK_COUNT, LF_PAGE_SIZE, LF_MEMORY_FLAGS and/or LF_DEVICE_COUNT. The library then computes on
+// constants (e.g. power of two sizes turn into shifts) and drops the code the memory
+// does not need. lf_app_init may leave the fixed fields untouched, or has to set the
+// same values.
+
+// Size of the RAM buffer used to assemble whole program pages. When 0 writes
+// are only split on page boundaries, otherwise every data write is page aligned.
+#ifndef LF_PAGE_BUFFER_SIZE
+#define LF_PAGE_BUFFER_SIZE (0)
+#endif
+
+// When 1 the driver shall implement lf_app_erase_range, which is used to erase
+// contiguous blocks with a single command.
+#ifndef LF_USE_ERASE_RANGE
+#define LF_USE_ERASE_RANGE (0)
+#endif
+
+// When 1 the driver shall implement lf_app_map, which gives direct access to
+// memory mapped blocks (e.g. internal flash), used by lf_read_direct.
+#ifndef LF_USE_MAP
+#define LF_USE_MAP (0)
+#endif
+
+// When 1 the library counts driver calls and block scans, see lf_get_stats.
+// The counters are not synchronized between threads (LF_USE_LOCK).
+#ifndef LF_USE_STATS
+#define LF_USE_STATS (0)
+#endif
+
+// When 1 a callback can be set, which is called on start and end of each API call.
+#ifndef LF_USE_TRACE
+#define LF_USE_TRACE (0)
+#endif
+
+// When 1 the library can be used from several threads, the driver shall implement
+// lf_app_lock and lf_app_unlock (e.g. an RTOS mutex). The lock is held only while
+// the list of open files is updated and while a free block is searched, never
+// while a block is erased. The driver calls may still come from several threads.
+#ifndef LF_USE_LOCK
+#define LF_USE_LOCK (0)
+#endif
+
+// Storage class of the state of the library. On a host 'static thread_local' (C++) or
+// 'static _Thread_local' (C11) gives each thread its own instance of the library with
+// its own memory, e.g. to run many simulated devices in parallel.
+#ifndef LF_STATE
+#define LF_STATE static
+#endif
+
+// When 1 files can be compressed (lf_create_compressed), the leading block of
+// each file then keeps its flags and content size. The images written with and
+// without the option are not compatible.
+#ifndef LF_USE_COMPRESSION
+#define LF_USE_COMPRESSION (0)
+#endif
+
+// When 1 the header of every block keeps a CRC-32 of its data, computed while the
+// data is written and checked while it is read. The read fails with LF_RESULT_CORRUPTED
+// when the end of a damaged block is reached (blocks partially skipped are not checked).
+// The images written with and without the option are not compatible.
+#ifndef LF_USE_CRC
+#define LF_USE_CRC (0)
+#endif
+
+// CRC-32 calculation methods
+#define LF_CRC_NIBBLE_TABLE (1) // 64 B table, for 8-bit MCUs
+#define LF_CRC_BYTE_TABLE (2) // 1 kB table
+#define LF_CRC_SLICE_BY_4 (3) // 4 kB table built in RAM by lf_init, 4 bytes per step
+#define LF_CRC_DRIVER (4) // lf_app_crc32 of the driver (e.g. CRC peripheral)
+#ifndef LF_CRC_METHOD
+#define LF_CRC_METHOD LF_CRC_BYTE_TABLE
+#endif
+
+// When 1 small values can be kept in a key-value store (lf_kv_set, lf_kv_get). The records
+// are appended to log blocks, so an update programs only the new record instead of
+// writing a whole file. The positions of the values are indexed in RAM and the log
+// blocks with many outdated records are compacted.
+#ifndef LF_USE_KV
+#define LF_USE_KV (0)
+#endif
+
+#if LF_USE_KV
+// number of keys the RAM index can hold (8 bytes each)
+#ifndef LF_KV_INDEX_SIZE
+#define LF_KV_INDEX_SIZE (64)
+#endif
+// maximum number of log blocks
+#ifndef LF_KV_MAX_BLOCKS
+#define LF_KV_MAX_BLOCKS (4)
+#endif
+// a log block is compacted when outdated records take this percent of it
+#ifndef LF_KV_COMPACT_PERCENT
+#define LF_KV_COMPACT_PERCENT (50)
+#endif
+#define LF_KV_VALUE_MAX (254)
+#endif
+
+// When 1 files of fixed size records can be created (lf_create_records). The record
+// size is kept in the leading block, which is 2 bytes bigger then, and the blocks hold
+// only whole records, so any record is read or written with a single driver call.
+#ifndef LF_USE_RECORDS
+#define LF_USE_RECORDS (0)
+#endif
+
+// When 1 several files can be replaced atomically (lf_txn_begin, lf_txn_commit). The files
+// written in a transaction are invisible until it is committed, and a reset leaves either
+// all the old or all the new versions. lf_init then scans the memory to finish or roll
+// back the interrupted transaction. The option adds the flags to the leading block.
+#ifndef LF_USE_TRANSACTIONS
+#define LF_USE_TRANSACTIONS (0)
+#endif
+
+// When 1 a file can be read while it is written (lf_reader_follow), e.g. to stream a log
+// as it grows. The reader gets the data programmed so far, found through the state of the
+// writer in RAM. lf_reader_wait blocks until there is more data, the driver shall then
+// implement lf_app_wait.
+#ifndef LF_USE_TAIL
+#define LF_USE_TAIL (0)
+#endif
+
+// When 1 a saved file can be shortened (lf_truncate) or changed (lf_overwrite) without
+// writing it again. On flash the changed bytes are programmed in place if they only clear
+// bits (counters, bitmaps, status flags), otherwise the blocks up to the changed ones are
+// copied, since their links can not be reprogrammed. The blocks behind them are kept. A copy
+// interrupted by a reset is finished or undone by lf_init, which scans the memory for it.
+#ifndef LF_USE_OVERWRITE
+#define LF_USE_OVERWRITE (0)
+#endif
+
+// When 1 files can be renamed (lf_rename) and copied (lf_copy) without passing their content
+// through the application. A rename programs the new key over the old one if it only clears
+// bits, otherwise it copies the leading block, which lf_init finishes or undoes after a reset.
+// A copy transfers the stored data block by block through a buffer of LF_COPY_BUFFER_SIZE bytes
+// on the stack.
+#ifndef LF_USE_COPY
+#define LF_USE_COPY (0)
+#endif
+
+#if LF_USE_COPY
+#ifndef LF_COPY_BUFFER_SIZE
+#define LF_COPY_BUFFER_SIZE (64)
+#endif
+#endif
+
+// When 1 blocks which fail to program or erase (worn out or factory marked NAND blocks, the
+// driver returns LF_RESULT_BAD_BLOCK) are retired. The data programmed to a failed block is
+// copied to a free one, which replaces it from then on, and the write is retried. The retired
+// blocks are kept in a table in RAM and in a system block, and are never allocated again.
+#ifndef LF_USE_BAD_BLOCKS
+#define LF_USE_BAD_BLOCKS (0)
+#endif
+
+#if LF_USE_BAD_BLOCKS
+// entries of the table (4 bytes each), it has to fit in a block as well
+#ifndef LF_BAD_BLOCKS_MAX
+#define LF_BAD_BLOCKS_MAX (32)
+#endif
+#endif
+
+// When 1 the memory can be a volume striped across several devices of the same geometry (e.g.
+// two SPI flash chips on separate buses), their number is set in deviceCount. The blocks are
+// numbered alternately, the device and its block are found by LF_STRIPE_DEVICE and
+// LF_STRIPE_BLOCK. Consecutive blocks of a file are allocated on different devices, so a driver
+// which completes the operations asynchronously keeps all the buses busy.
+#ifndef LF_USE_STRIPING
+#define LF_USE_STRIPING (0)
+#endif
+
+#if LF_USE_STRIPING
+#define LF_STRIPE_DEVICE(block, deviceCount) ((block) % (deviceCount))
+#define LF_STRIPE_BLOCK(block, deviceCount) ((block) / (deviceCount))
+#endif
+
+// When 1 the RAM buffers sized by the configuration (the page buffer, the index of the key-value
+// store, the bad block table and the slice-by-4 CRC table) are not static. They are carved from
+// a workspace the application passes to lf_mount, which reports the size each feature needs, so
+// the RAM can be budgeted per product or shared until the memory is mounted. The CRC table is
+// optional, without room for it the CRC is computed bit by bit.
+#ifndef LF_USE_WORKSPACE
+#define LF_USE_WORKSPACE (0)
+#endif
+
+#if LF_USE_COMPRESSION
+// The compressor and the decompressor work in a caller provided workspace: a history
+// window of 2^windowBits bytes (windowBits from 4 to 12) and an I/O buffer. A bigger
+// window compresses better, the window of the writer is needed to read the file.
+#define LF_COMPRESSION_BUFFER_SIZE (64)
+#define LF_COMPRESSION_WORKSPACE_SIZE(windowBits) ((1u << (windowBits)) + LF_COMPRESSION_BUFFER_SIZE)
+#endif
+
+#if LF_USE_STATS
+typedef struct {
+    uint32_t reads; // lf_app_read calls
+    uint32_t writes; // lf_app_write calls
+    uint32_t erases; // lf_app_delete and lf_app_erase_range calls
+    uint32_t bytesRead;
+    uint32_t bytesWritten;
+    uint32_t blocksErased;
+    uint32_t lookups; // searches for a file
+    uint32_t lookupProbes; // blocks checked by the searches
+    uint32_t allocations; // searches for a free block
+    uint32_t allocationProbes; // blocks checked by the searches
+    uint32_t blocksRetired; // bad blocks added to the table (LF_USE_BAD_BLOCKS)
+} lf_stats;
+#endif
+
+#if LF_USE_TRACE
+typedef enum {
+    LF_TRACE_INIT,
+    LF_TRACE_EXISTS,
+    LF_TRACE_FORMAT,
+    LF_TRACE_DELETE,
+    LF_TRACE_CREATE,
+    LF_TRACE_WRITE,
+    LF_TRACE_SAVE,
+    LF_TRACE_OPEN,
+    LF_TRACE_READ,
+    LF_TRACE_READ_SOME,
+    LF_TRACE_READ_DIRECT,
+    LF_TRACE_CLOSE,
+    LF_TRACE_READER_OPEN,
+    LF_TRACE_READER_READ,
+    LF_TRACE_READER_READ_SOME,
+    LF_TRACE_READER_CLOSE,
+    LF_TRACE_SIZE,
+    LF_TRACE_CREATE_COMPRESSED,
+    LF_TRACE_OPEN_COMPRESSED,
+    LF_TRACE_READER_OPEN_COMPRESSED,
+    LF_TRACE_KV_SET,
+    LF_TRACE_KV_GET,
+    LF_TRACE_CREATE_RECORDS,
+    LF_TRACE_RECORDS_OPEN,
+    LF_TRACE_READ_RECORD,
+    LF_TRACE_WRITE_RECORD,
+    LF_TRACE_RECORDS_CLOSE,
+    LF_TRACE_TXN_BEGIN,
+    LF_TRACE_TXN_COMMIT,
+    LF_TRACE_TXN_ABORT,
+    LF_TRACE_READER_FOLLOW,
+    LF_TRACE_READER_WAIT,
+    LF_TRACE_TRUNCATE,
+    LF_TRACE_OVERWRITE,
+    LF_TRACE_RENAME,
+    LF_TRACE_COPY,
+    LF_TRACE_MOUNT
+} lf_trace_call;
+
+// 'end' is 0 when the call starts, and 1 when it returns 'result'
+typedef void (*lf_trace_callback)(lf_trace_call call, uint8_t end, lf_result_t result);
+#endif
+
+// Reading handle, any number of files can be read at the same time through
+// separate handles (also while a file is written). The fields are private.
+typedef struct lf_reader {
+    uint16_t currentBlock;
+    uint16_t nextBlock;
+    uint16_t cursor;
+    uint16_t size;
+    uint8_t key;
+    uint8_t open;
+    uint8_t leading; // the current block is the leading one
+#if LF_USE_TAIL
+    uint8_t follow; // opened with lf_reader_follow
+    uint8_t growing; // the current block is still written
+#endif
+#if LF_USE_CRC
+    uint8_t verify; // the current block is read from its beginning
+    uint32_t crc;
+    uint32_t blockCrc;
+#endif
+#if LF_USE_COMPRESSION
+    uint8_t *window; // decompression workspace, NULL if the file is not compressed
+    uint16_t windowMask;
+    uint16_t windowPos;
+    uint16_t matchDistance;
+    uint8_t matchLength;
+    uint8_t itemFlags;
+    uint8_t itemCount;
+    uint8_t inputPos;
+    uint8_t inputLength;
+#endif
+    struct lf_reader *next; // list of the open handles
+} lf_reader;
+
+#if LF_USE_RECORDS
+// Record file handle, the chain of the blocks of the file is cached in a caller
+// provided table. Only 'count' can be read by the application.
+typedef struct {
+    lf_reader reader;
+    uint32_t count; // number of records
+    uint16_t recordSize;
+    uint16_t leadingCount; // records in the leading block
+    uint16_t blockCount; // records in a following block
+    uint16_t *chain;
+} lf_records;
+#endif
+
+#if LF_USE_WORKSPACE
+// bytes of the workspace taken by each feature, 0 if the feature is not used
+typedef struct {
+    size_t pageBuffer; // LF_PAGE_BUFFER_SIZE
+    size_t kvIndex; // LF_USE_KV
+    size_t badBlocks; // LF_USE_BAD_BLOCKS
+    size_t crcTable; // LF_CRC_SLICE_BY_4, optional
+    size_t required; // all but the optional ones
+    size_t total;
+} lf_workspace_sizes;
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 // general
 lf_result_t lf_init(void);
-lf_result_t lf_delete(uint8_t key); // deletes the file
+lf_result_t lf_delete(uint8_t key); // deletes the file, fails with LF_RESULT_INVALID_STATE if it is open
 lf_result_t lf_exists(uint8_t key); // checks if file exists
+lf_result_t lf_size(uint8_t key, uint32_t *size); // gets the size of the file content (before compression)
+lf_result_t lf_format(void); // erases the entire memory, no file can be open
+#if LF_USE_WORKSPACE
+lf_result_t lf_mount(void *workspace, size_t size, lf_workspace_sizes *sizes);
+    // lf_init with the workspace (aligned to 4 bytes), which has to stay valid until the next lf_mount,
+    // a later lf_init keeps using it. 'sizes' (can be NULL) receives the sizes the features need, with
+    // a NULL workspace they are only reported. Fails with LF_RESULT_OUT_OF_MEMORY if 'size' is smaller
+    // than sizes->required.
+#endif
 
 // write
 lf_result_t lf_create(uint8_t key); // starts writing mode
@@ -68,17 +396,128 @@ lf_result_t lf_save(void); // ends writing mode
 // read
 lf_result_t lf_open(uint8_t key); // starts reading mode
 lf_result_t lf_read(void *content, size_t length); // reads data, or skips it if 'content' is null
+lf_result_t lf_read_some(void *content, size_t length, size_t *readLength);
+    // as lf_read, but stops on the end of the file, returns LF_RESULT_END_OF_FILE only if nothing was read
 lf_result_t lf_close(void); // ends reading mode
+#if LF_USE_MAP
+lf_result_t lf_read_direct(const void **content, size_t *length);
+    // points 'content' to the data in the mapped memory without copying it. On input 'length' is the maximum
+    // number of bytes to read, on output the number of bytes available (never more than the rest of the current block)
+#endif
+
+#if LF_USE_COMPRESSION
+// the workspace has to stay valid until the file is saved or closed,
+// the open functions accept also not compressed files (the workspace is then not used)
+lf_result_t lf_create_compressed(uint8_t key, void *workspace, size_t size);
+lf_result_t lf_open_compressed(uint8_t key, void *workspace, size_t size);
+lf_result_t lf_reader_open_compressed(lf_reader *reader, uint8_t key, void *workspace, size_t size);
+    // the plain open functions fail on compressed files with LF_RESULT_INVALID_ARGS
+#endif
+
+// read through a handle, the handle has to be closed (or zeroed) before it is opened
+lf_result_t lf_reader_open(lf_reader *reader, uint8_t key);
+lf_result_t lf_reader_read(lf_reader *reader, void *content, size_t length); // as lf_read
+lf_result_t lf_reader_read_some(lf_reader *reader, void *content, size_t length, size_t *readLength); // as lf_read_some
+lf_result_t lf_reader_close(lf_reader *reader);
+
+#if LF_USE_TAIL
+lf_result_t lf_reader_follow(lf_reader *reader, uint8_t key);
+    // as lf_reader_open, but opens also the file being written (not compressed). The reads return
+    // LF_RESULT_NO_DATA when all the data written so far was read, and LF_RESULT_END_OF_FILE once
+    // the file is saved (lf_reader_read_some returns the data read before). The written data is visible
+    // when it is programmed (see LF_PAGE_BUFFER_SIZE).
+lf_result_t lf_reader_wait(lf_reader *reader);
+    // waits until there is data to read (LF_RESULT_SUCCESS) or the file is saved and read (LF_RESULT_END_OF_FILE)
+#endif
+
+#if LF_USE_OVERWRITE
+// the file can not be open and no other file can be written meanwhile, compressed files are not supported
+lf_result_t lf_truncate(uint8_t key, uint32_t length); // shortens the file to 'length' bytes, freeing the blocks behind
+lf_result_t lf_overwrite(uint8_t key, uint32_t offset, const void *data, size_t length);
+    // replaces 'length' bytes of the content from 'offset', the file is not extended (LF_RESULT_END_OF_FILE).
+    // With LF_USE_CRC the changed blocks are always copied.
+#endif
+
+#if LF_USE_COPY
+// the new key can not exist, the file can not be open (lf_rename) or written, not available in a transaction
+lf_result_t lf_rename(uint8_t key, uint8_t newKey);
+lf_result_t lf_copy(uint8_t key, uint8_t newKey); // the copy keeps the compression and the record size
+#endif
+
+#if LF_USE_TRANSACTIONS
+// lf_create in a transaction writes a new version of the file, the old one stays readable until the commit
+lf_result_t lf_txn_begin(void);
+lf_result_t lf_txn_commit(void); // no file of the transaction can be written or open
+    // The old versions are erased by the commit, not later: a file is found by its key, so two
+    // committed versions can not be told apart. The erasing is done while the commit record
+    // exists, so lf_init resumes it after a reset, and its time is paid by lf_txn_commit.
+lf_result_t lf_txn_abort(void); // deletes the new versions
+#endif
+
+#if LF_USE_RECORDS
+// the records are written with lf_write (in any batches), an incomplete last record is not counted
+lf_result_t lf_create_records(uint8_t key, uint16_t recordSize);
+lf_result_t lf_records_open(lf_records *file, uint8_t key, uint16_t *chain, uint16_t chainLength);
+    // 'chain' needs an entry for each block of the file, otherwise LF_RESULT_OUT_OF_MEMORY is returned
+lf_result_t lf_read_record(lf_records *file, uint32_t index, void *record);
+lf_result_t lf_write_record(lf_records *file, uint32_t index, const void *record);
+    // overwrites the record in place, on not rewritable memories it can only clear bits (e.g. fill a record
+    // written as 0xff bytes), fails with LF_RESULT_INVALID_STATE otherwise and always with LF_USE_CRC
+lf_result_t lf_records_close(lf_records *file);
+#endif
+
+#if LF_USE_KV
+// the values have their own 16-bit keys, independent from the file keys, and are
+// accessed from one thread at a time
+lf_result_t lf_kv_set(uint16_t key, const void *value, size_t length); // stores up to LF_KV_VALUE_MAX bytes
+lf_result_t lf_kv_get(uint16_t key, void *value, size_t size, size_t *length);
+    // copies up to 'size' bytes of the value, 'length' receives the length of the whole value
+#endif
+
+#if LF_USE_STATS
+void lf_get_stats(lf_stats *stats); // copies the counters
+void lf_reset_stats(void); // zeroes the counters
+#endif
+
+#if LF_USE_TRACE
+void lf_set_trace(lf_trace_callback callback); // NULL disables tracing
+#endif
 
 // TO IMPLEMENT!!! Shall return LF_RESULT_SUCCESS or LF_RESULT_FAILED
 lf_result_t lf_app_init(lf_memory_config *config);
     // shall update the configuration
 lf_result_t lf_app_write(uint16_t block, uint16_t offset, void *buffer, size_t length, uint8_t flush);
-    // shall write 'length' number of bytes from 'buffer' to the block number 'block' starting on 'offset' byte
+    // shall write 'length' number of bytes from 'buffer' to the block number 'block' starting on 'offset' byte,
+    // if 'pageSize' is set the write never crosses a page boundary,
+    // on rewritable memories it should skip the bytes that already hold the requested value
 lf_result_t lf_app_read(uint16_t block, uint16_t offset, void *buffer, size_t length);
     // shall read 'length' number of bytes to 'buffer' from the block number 'block' starting on 'offset' byte
 lf_result_t lf_app_delete(uint16_t block);
-    // shall erase block number 'block'
+    // shall erase block number 'block', not used for rewritable memories
+    // with LF_USE_BAD_BLOCKS a failed program or erase (also of lf_app_erase_range) shall return LF_RESULT_BAD_BLOCK
+#if LF_USE_MAP
+const void *lf_app_map(uint16_t block);
+    // shall return the address of the block number 'block' in the address space, or NULL if it is not mapped
+#endif
+#if LF_USE_ERASE_RANGE
+lf_result_t lf_app_erase_range(uint16_t block, uint16_t count);
+    // shall erase 'count' blocks starting on the block number 'block', may use chip erase if all the blocks are requested
+#endif
+#if LF_USE_CRC && LF_CRC_METHOD == LF_CRC_DRIVER
+uint32_t lf_app_crc32(uint32_t crc, const void *data, size_t length);
+    // shall continue the CRC-32 (IEEE 802.3, as zlib crc32) 'crc' of the previous data with 'length' bytes of 'data',
+    // 'crc' is 0 for the beginning
+#endif
+#if LF_USE_TAIL
+void lf_app_wait(void);
+    // shall block the calling thread until the followed file may have changed (e.g. for a tick, or until
+    // the writer signals), called by lf_reader_wait
+#endif
+#if LF_USE_LOCK
+void lf_app_lock(void);
+void lf_app_unlock(void);
+    // shall take and give back a mutex shared by all the threads using the library
+#endif
 
 
 #ifdef __cplusplus
@@ -0,0 +1,226 @@
+/*
+ * LightFiles
+ *
+ * Author: Grzegorz Świstak (NeghMC)
+ *
+ * DISCLAIMER: This software is provided 'as-is', without any express
+ * or implied warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED 'AS IS', WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIGHT_FILES_HPP
+#define LIGHT_FILES_HPP
+
+#include "light_files.h"
+#include <streambuf>
+#include <type_traits>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+/*
+C++ layer over the library. It does not allocate memory and does not throw,
+errors are reported by the returned lf_result_t and result() of the objects.
+
+    {
+        lf::writer file(key); // lf_create
+        file.write(data, size);
+    } // lf_save
+
+    lf::reader file(key); // lf_reader_open
+    lf::istreambuf<64> buffer(file);
+    std::istream stream(&buffer);
+    stream >> value;
+*/
+
+namespace lf {
+
+// base of the file objects, keeps the result of the last operation
+class file {
+public:
+    file(const file&) = delete;
+    file &operator=(const file&) = delete;
+
+    // true while the file is open
+    explicit operator bool() const {return mOpen;}
+    bool is_open() const {return mOpen;}
+
+    // result of the last operation
+    lf_result_t result() const {return mResult;}
+
+protected:
+    explicit file(lf_result_t result) : mResult(result), mOpen(result == LF_RESULT_SUCCESS) {}
+    file(file &&other) : mResult(other.mResult), mOpen(other.mOpen) {other.mOpen = false;}
+
+    lf_result_t set(lf_result_t result) {mResult = result; return result;}
+
+    lf_result_t mResult;
+    bool mOpen;
+};
+
+// file opened for reading through its own handle, closed on destruction,
+// any number of readers can be open at the same time
+class reader : public file {
+public:
+    explicit reader(uint8_t key) : file(LF_RESULT_INVALID_STATE), mHandle()
+    {
+        mOpen = (set(lf_reader_open(&mHandle, key)) == LF_RESULT_SUCCESS);
+    }
+    // the handle is linked in the list of the open files, so it can not move
+    reader(reader &&other) = delete;
+    ~reader() {close();}
+
+    // reads exactly 'length' bytes
+    lf_result_t read(void *content, size_t length) {return set(lf_reader_read(&mHandle, content, length));}
+
+    // reads up to 'length' bytes, stops on the end of the file
+    lf_result_t read_some(void *content, size_t length, size_t *readLength) {return set(lf_reader_read_some(&mHandle, content, length, readLength));}
+
+    lf_result_t skip(size_t length) {return set(lf_reader_read(&mHandle, NULL, length));}
+
+#if __cplusplus >= 202002L
+    template<class T, size_t E>
+    lf_result_t read(std::span<T, E> content)
+    {
+        static_assert(std::is_trivially_copyable_v<T> && !std::is_const_v<T>, "content has to be writable plain data");
+        return read(content.data(), content.size_bytes());
+    }
+#endif
+
+    lf_result_t close()
+    {
+        if(!mOpen)
+        {
+            return LF_RESULT_SUCCESS;
+        }
+        mOpen = false;
+        return set(lf_reader_close(&mHandle));
+    }
+
+private:
+    lf_reader mHandle;
+};
+
+// file opened for writing, saved on destruction
+class writer : public file {
+public:
+    explicit writer(uint8_t key) : file(lf_create(key)) {}
+    writer(writer &&other) = default;
+    ~writer() {save();}
+
+    lf_result_t write(const void *content, size_t length) {return set(lf_write(const_cast<void*>(content), length));}
+
+#if __cplusplus >= 202002L
+    template<class T, size_t E>
+    lf_result_t write(std::span<T, E> content)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "content has to be plain data");
+        return write(content.data(), content.size_bytes());
+    }
+#endif
+
+    lf_result_t save()
+    {
+        if(!mOpen)
+        {
+            return LF_RESULT_SUCCESS;
+        }
+        mOpen = false;
+        return set(lf_save());
+    }
+};
+
+// stream buffer reading a file in batches of N bytes
+template<size_t N>
+class istreambuf : public std::streambuf {
+    static_assert(N > 0, "buffer can not be empty");
+
+public:
+    explicit istreambuf(reader &file) : mFile(file) {}
+
+protected:
+    int_type underflow() override
+    {
+        if(gptr() < egptr())
+        {
+            return traits_type::to_int_type(*gptr());
+        }
+
+        size_t readLength = 0;
+        if(!mFile || mFile.read_some(mBuffer, N, &readLength) != LF_RESULT_SUCCESS)
+        {
+            return traits_type::eof();
+        }
+        setg(mBuffer, mBuffer, mBuffer + readLength);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    reader &mFile;
+    char mBuffer[N];
+};
+
+// stream buffer writing a file in batches of N bytes, the rest is written on sync or destruction
+template<size_t N>
+class ostreambuf : public std::streambuf {
+    static_assert(N > 0, "buffer can not be empty");
+
+public:
+    explicit ostreambuf(writer &file) : mFile(file) {setp(mBuffer, mBuffer + N);}
+    ~ostreambuf() {sync();}
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if(flush() != 0)
+        {
+            return traits_type::eof();
+        }
+        if(!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {return flush();}
+
+private:
+    // the buffered bytes are kept if the write fails, so the sync can be retried
+    int flush()
+    {
+        size_t length = pptr() - pbase();
+        if(length != 0 && !(mFile && mFile.write(mBuffer, length) == LF_RESULT_SUCCESS))
+        {
+            return -1;
+        }
+        setp(mBuffer, mBuffer + N);
+        return 0;
+    }
+
+    writer &mFile;
+    char mBuffer[N];
+};
+
+} // namespace lf
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * LightFiles
+ *
+ * Author: Grzegorz Świstak (NeghMC)
+ *
+ * DISCLAIMER: This software is provided 'as-is', without any express
+ * or implied warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED 'AS IS', WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIGHT_FILES_CORO_HPP
+#define LIGHT_FILES_CORO_HPP
+
+#include "light_files.h"
+#include <coroutine>
+#include <exception>
+
+/*
+C++20 coroutines over the library.
+
+The library keeps the state of a single open file, so the files are used in
+sessions - from lf_open/lf_create to lf_close/lf_save (lf_delete is a session
+on its own). A coroutine starting a session waits until the previous one ends.
+A session belongs to the spawned task which started it (also from an awaited
+task), the operations of the other tasks wait until it ends. If the task
+finishes with the session open, the executor ends it with lf_close or lf_save. Before each call the coroutine is suspended until the
+device reports it is ready (e.g. a flash program or erase is no longer
+pending), meanwhile the executor resumes the other coroutines. When none of
+them can run, the executor calls its idle function (e.g. to sleep until an
+interrupt) instead of polling the device in a loop.
+
+    lf::task log(lf::executor &exec)
+    {
+        lf_result_t result = co_await exec.create(1);
+        if(result != LF_RESULT_SUCCESS) co_return result;
+        co_await exec.write(data, size);
+        co_return co_await exec.save();
+    }
+
+    lf::executor exec(deviceReady, waitForInterrupt);
+    lf::task t = log(exec);
+    exec.spawn(t);
+    exec.run(); // t.result() holds the result
+
+The executor runs on the calling thread and does not allocate memory (the
+frames of the coroutines are allocated by the compiler as usual).
+*/
+
+namespace lf {
+
+class executor;
+class task;
+
+namespace detail {
+
+// suspended coroutine queued in the executor
+struct waiter {
+    std::coroutine_handle<> handle;
+    waiter *next = nullptr;
+    bool device = false; // waits for the device to be ready
+    bool session = false; // starts a session
+    const void *owner = nullptr; // spawned task of an operation, it waits for the session of another one
+};
+
+} // namespace detail
+
+// coroutine returning lf_result_t, started by executor::spawn or by co_await
+class task {
+public:
+    struct promise_type {
+        lf_result_t result = LF_RESULT_FAILED;
+        std::coroutine_handle<> continuation;
+        promise_type *root = this; // the spawned task, which owns the sessions
+        executor *exec = nullptr; // of the spawned task
+
+        task get_return_object() {return task(std::coroutine_handle<promise_type>::from_promise(*this));}
+        std::suspend_always initial_suspend() noexcept {return {};}
+
+        // the awaiting coroutine is resumed when the task finishes
+        struct final_awaiter {
+            bool await_ready() noexcept {return false;}
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+            void await_resume() noexcept {}
+        };
+        final_awaiter final_suspend() noexcept {return {};}
+
+        void return_value(lf_result_t value) {result = value;}
+        void unhandled_exception() {std::terminate();}
+    };
+
+    task(task &&other) : mHandle(other.mHandle) {other.mHandle = nullptr;}
+    task(const task&) = delete;
+    task &operator=(const task&) = delete;
+    ~task() {if(mHandle) mHandle.destroy();}
+
+    bool done() const {return mHandle && mHandle.done();}
+    lf_result_t result() const {return mHandle.promise().result;}
+
+    // awaiting runs the task and returns its result
+    bool await_ready() const {return done();}
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> continuation)
+    {
+        mHandle.promise().continuation = continuation;
+        mHandle.promise().root = continuation.promise().root;
+        return mHandle;
+    }
+    lf_result_t await_resume() const {return result();}
+
+private:
+    friend class executor;
+    explicit task(std::coroutine_handle<promise_type> handle) : mHandle(handle) {}
+
+    std::coroutine_handle<promise_type> mHandle;
+    detail::waiter mStart;
+};
+
+// single-threaded executor of the file operations
+class executor {
+public:
+    // 'ready' shall return true if the device can accept the next operation, NULL if it always can,
+    // 'idle' is called when no coroutine can run until the device is ready, NULL to poll it again
+    explicit executor(bool (*ready)(void) = nullptr, void (*idle)(void) = nullptr) : mReady(ready), mIdle(idle) {}
+    executor(const executor&) = delete;
+    executor &operator=(const executor&) = delete;
+
+    // queues the task, it has to live until it is done
+    void spawn(task &t)
+    {
+        t.mHandle.promise().exec = this;
+        t.mStart.handle = t.mHandle;
+        push(&t.mStart);
+    }
+
+    // resumes the queued coroutines until all of them are done
+    void run()
+    {
+        while(mHead != nullptr)
+        {
+            // one pass over the queue, the device is polled again only after a coroutine ran
+            bool resumed = false;
+            bool polled = false;
+            bool ready = true;
+            detail::waiter *last = mTail;
+            detail::waiter *w;
+            do
+            {
+                w = pop();
+                if(w->device && mReady != nullptr && !polled)
+                {
+                    ready = mReady();
+                    polled = true;
+                }
+                // a session can not start during another one, nor can its calls be made by another task
+                bool otherSession = mSession && (w->session || (w->owner != nullptr && w->owner != mOwner));
+                if((w->device && !ready) || otherSession)
+                {
+                    push(w);
+                    continue;
+                }
+                if(w->session)
+                {
+                    mSession = true;
+                }
+                w->handle.resume();
+                resumed = true;
+                polled = false;
+                ready = true;
+            } while(w != last);
+
+            if(!resumed && mIdle != nullptr)
+            {
+                mIdle();
+            }
+        }
+    }
+
+    // ---- awaitable operations, each returns lf_result_t ----
+
+    class operation : detail::waiter {
+    public:
+        bool await_ready() const {return false;}
+        void await_suspend(std::coroutine_handle<task::promise_type> handle)
+        {
+            this->handle = handle;
+            owner = handle.promise().root;
+            mExecutor.push(this);
+        }
+        lf_result_t await_resume()
+        {
+            lf_result_t result = mCall(mArgs);
+            // the session ends with its last call or when it could not start
+            if(mEnd || (session && result != LF_RESULT_SUCCESS))
+            {
+                mExecutor.mSession = false;
+                mExecutor.mOwner = nullptr;
+            }
+            else if(session)
+            {
+                mExecutor.mOwner = owner;
+                mExecutor.mEndSession = mEndSession;
+            }
+            return result;
+        }
+
+    private:
+        friend class executor;
+        struct args {
+            void *content;
+            size_t length;
+            uint8_t key;
+        };
+
+        // 'endSession' ends the session started by the operation if its owner does not
+        operation(executor &exec, lf_result_t (*call)(args&), args a, bool start, bool end, lf_result_t (*endSession)(void) = nullptr)
+            : mExecutor(exec), mCall(call), mArgs(a), mEnd(end), mEndSession(endSession)
+        {
+            device = true;
+            session = start;
+        }
+
+        executor &mExecutor;
+        lf_result_t (*mCall)(args&);
+        args mArgs;
+        bool mEnd;
+        lf_result_t (*mEndSession)(void);
+    };
+
+    operation open(uint8_t key) {return operation(*this, [](operation::args &a) {return lf_open(a.key);}, {nullptr, 0, key}, true, false, lf_close);}
+    operation read(void *content, size_t length) {return operation(*this, [](operation::args &a) {return lf_read(a.content, a.length);}, {content, length, 0}, false, false);}
+    operation close() {return operation(*this, [](operation::args&) {return lf_close();}, {nullptr, 0, 0}, false, true);}
+
+    // a session abandoned by its owner saves the data written so far
+    operation create(uint8_t key) {return operation(*this, [](operation::args &a) {return lf_create(a.key);}, {nullptr, 0, key}, true, false, lf_save);}
+    operation write(const void *content, size_t length) {return operation(*this, [](operation::args &a) {return lf_write(a.content, a.length);}, {const_cast<void*>(content), length, 0}, false, false);}
+    operation save() {return operation(*this, [](operation::args&) {return lf_save();}, {nullptr, 0, 0}, false, true);}
+
+    operation remove(uint8_t key) {return operation(*this, [](operation::args &a) {return lf_delete(a.key);}, {nullptr, 0, key}, true, true);}
+
+private:
+    friend struct task::promise_type::final_awaiter;
+
+    // the spawned task 'owner' finished, its session can not end otherwise
+    void finished(task::promise_type *owner)
+    {
+        if(mSession && mOwner == owner)
+        {
+            mEndSession();
+            mSession = false;
+            mOwner = nullptr;
+        }
+    }
+
+    void push(detail::waiter *w)
+    {
+        w->next = nullptr;
+        if(mTail != nullptr)
+        {
+            mTail->next = w;
+        }
+        else
+        {
+            mHead = w;
+        }
+        mTail = w;
+    }
+
+    detail::waiter *pop()
+    {
+        detail::waiter *w = mHead;
+        mHead = w->next;
+        if(mHead == nullptr)
+        {
+            mTail = nullptr;
+        }
+        return w;
+    }
+
+    bool (*mReady)(void);
+    void (*mIdle)(void);
+    detail::waiter *mHead = nullptr;
+    detail::waiter *mTail = nullptr;
+    bool mSession = false;
+    const void *mOwner = nullptr; // spawned task of the session
+    lf_result_t (*mEndSession)(void) = nullptr;
+};
+
+inline std::coroutine_handle<> task::promise_type::final_awaiter::await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+{
+    promise_type &promise = handle.promise();
+    if(promise.exec != nullptr)
+    {
+        promise.exec->finished(&promise);
+    }
+    std::coroutine_handle<> continuation = promise.continuation;
+    return continuation ? continuation : std::noop_coroutine();
+}
+
+} // namespace lf
+
+#endif
@@ -10,12 +10,14 @@ lf_result_t lf_app_init(lf_memory_config *config) {
   uint16_t blockSize = 128;
   config->blockSize = sBlockSize = blockSize;
   config->blockCount = sBlockCount = EEPROM.length() / blockSize;
+  config->flags = LF_MEMORY_FLAG_REWRITABLE;  // EEPROM does not need to be erased
   return LF_RESULT_SUCCESS;
 }
 
 lf_result_t lf_app_write(uint16_t block, uint16_t offset, void *buffer, size_t length, uint8_t flush) {
   for (size_t i = 0; i < length; ++i) {
-    EEPROM.write(block * sBlockSize + offset + i, ((uint8_t *)buffer)[i]);
+    // update() skips the bytes that do not change, saving time and EEPROM endurance
+    EEPROM.update(block * sBlockSize + offset + i, ((uint8_t *)buffer)[i]);
   }
   return LF_RESULT_SUCCESS;
 }
@@ -109,8 +111,9 @@ void setup() {
 
   if (FIRST_USE) {
     Serial.println("Preparing for the first use...");
-    for (int i = 0; i < EEPROM.length(); i++) {
-      EEPROM.write(i, 0xff);
+    result = lf_format();
+    if (result != LF_RESULT_SUCCESS) {
+      error_handler("Could not format the memory.");
     }
     Serial.println("Done.");
   } else {
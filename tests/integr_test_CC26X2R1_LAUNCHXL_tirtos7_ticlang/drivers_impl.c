@@ -45,8 +45,7 @@ lf_result_t lf_app_init(lf_memory_config *config)
     // set LF parameters
     config->blockCount = regionAttrs.regionSize/regionAttrs.sectorSize;
     config->blockSize = regionAttrs.sectorSize;
-
-    NVS_erase(nvsHandle, 0, regionAttrs.regionSize);
+    config->pageSize = 256; // program page of the external SPI flash
 
     return LF_RESULT_SUCCESS;
 }
@@ -89,3 +88,16 @@ lf_result_t lf_app_delete(uint16_t block)
         return LF_RESULT_FAILED;
     }
 }
+
+lf_result_t lf_app_erase_range(uint16_t block, uint16_t count)
+{
+    uint16_t ret = NVS_erase(nvsHandle, block*regionAttrs.sectorSize, count*regionAttrs.sectorSize);
+    if(ret == NVS_STATUS_SUCCESS)
+    {
+        return LF_RESULT_SUCCESS;
+    }
+    else
+    {
+        return LF_RESULT_FAILED;
+    }
+}
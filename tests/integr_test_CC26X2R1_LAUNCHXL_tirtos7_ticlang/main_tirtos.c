@@ -206,6 +206,13 @@ void *testThread(void *arg0)
         while(1);
     }
 
+    // start with an empty memory
+    result = lf_format();
+    if(result != LF_RESULT_SUCCESS)
+    {
+        while(1);
+    }
+
     simpleTest();
     complexTest();
 
@@ -0,0 +1,228 @@
+// Benchmark of the library running on the memory simulator.
+// Each workload starts on an erased memory, the driver activity and the time
+// of the workload are reported, so the results of different versions of the
+// library (or its configurations) can be compared.
+//
+// usage: benchmark [nor|nand|eeprom]
+//   selects the device profile used to estimate the time the real memory would
+//   need (NOR by default)
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include "light_files.h"
+#include "memory_impl.hpp"
+
+using namespace std;
+
+static const uint16_t blockSize = 4096;
+static const uint16_t blockCount = 256;
+static const uint16_t pageSize = 256;
+
+static vector<uint8_t> memory;
+static vector<uint8_t> buffer(64 * 1024);
+static mt19937 generator;
+
+#define B_ASSERT(cond) if(!(cond)) {cout << "Benchmark failed at line " << __LINE__ << "." << endl; return false;}
+
+// ---- workloads, each counts the operations it performed in 'ops' ----
+
+// small files are created and deleted over and over
+static bool smallFileChurn(unsigned long *ops)
+{
+    const int files = 64;
+    for(int i = 0; i < 2000; ++i)
+    {
+        uint8_t key = i % files;
+        if(lf_exists(key) == LF_RESULT_SUCCESS)
+        {
+            B_ASSERT(lf_delete(key) == LF_RESULT_SUCCESS);
+        }
+        B_ASSERT(lf_create(key) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_write(buffer.data(), 16 + (generator() % 48)) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_save() == LF_RESULT_SUCCESS);
+        *ops += 1;
+    }
+    return true;
+}
+
+// a big file is written and read back in batches
+static bool largeSequential(unsigned long *ops)
+{
+    const size_t fileSize = 512 * 1024;
+    const size_t batch = 256;
+
+    B_ASSERT(lf_create(0) == LF_RESULT_SUCCESS);
+    for(size_t written = 0; written < fileSize; written += batch)
+    {
+        B_ASSERT(lf_write(buffer.data(), batch) == LF_RESULT_SUCCESS);
+        *ops += 1;
+    }
+    B_ASSERT(lf_save() == LF_RESULT_SUCCESS);
+
+    for(int pass = 0; pass < 4; ++pass)
+    {
+        B_ASSERT(lf_open(0) == LF_RESULT_SUCCESS);
+        for(size_t read = 0; read < fileSize; read += batch)
+        {
+            B_ASSERT(lf_read(buffer.data(), batch) == LF_RESULT_SUCCESS);
+            *ops += 1;
+        }
+        B_ASSERT(lf_close() == LF_RESULT_SUCCESS);
+    }
+    return true;
+}
+
+// short records are read from random positions of a big file
+static bool randomSeek(unsigned long *ops)
+{
+    const size_t fileSize = 512 * 1024;
+    const size_t record = 16;
+
+    B_ASSERT(lf_create(0) == LF_RESULT_SUCCESS);
+    B_ASSERT(lf_write(buffer.data(), buffer.size()) == LF_RESULT_SUCCESS);
+    for(size_t written = buffer.size(); written < fileSize; written += buffer.size())
+    {
+        B_ASSERT(lf_write(buffer.data(), buffer.size()) == LF_RESULT_SUCCESS);
+    }
+    B_ASSERT(lf_save() == LF_RESULT_SUCCESS);
+
+    for(int i = 0; i < 2000; ++i)
+    {
+        size_t position = (generator() % (fileSize / record)) * record;
+        B_ASSERT(lf_open(0) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_read(NULL, position) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_read(buffer.data(), record) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_close() == LF_RESULT_SUCCESS);
+        *ops += 1;
+    }
+    return true;
+}
+
+// log entries are appended to rotated log files
+static bool appendLogging(unsigned long *ops)
+{
+    const int logFiles = 4;
+    const int entriesPerFile = 4000;
+    const size_t entry = 24;
+
+    for(int file = 0; file < 16; ++file)
+    {
+        uint8_t key = file % logFiles;
+        if(lf_exists(key) == LF_RESULT_SUCCESS)
+        {
+            B_ASSERT(lf_delete(key) == LF_RESULT_SUCCESS);
+        }
+        B_ASSERT(lf_create(key) == LF_RESULT_SUCCESS);
+        for(int i = 0; i < entriesPerFile; ++i)
+        {
+            B_ASSERT(lf_write(buffer.data(), entry) == LF_RESULT_SUCCESS);
+            *ops += 1;
+        }
+        B_ASSERT(lf_save() == LF_RESULT_SUCCESS);
+    }
+    return true;
+}
+
+// files are replaced while the memory is almost full
+static bool nearFull(unsigned long *ops)
+{
+    const int files = 120;
+    const size_t fileSize = 2 * (blockSize - 5); // 2 blocks each, 240 of 256 blocks used
+
+    for(int key = 0; key < files; ++key)
+    {
+        B_ASSERT(lf_create(key) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_write(buffer.data(), fileSize) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_save() == LF_RESULT_SUCCESS);
+    }
+
+    for(int i = 0; i < 2000; ++i)
+    {
+        uint8_t key = generator() % files;
+        B_ASSERT(lf_delete(key) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_create(key) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_write(buffer.data(), fileSize) == LF_RESULT_SUCCESS);
+        B_ASSERT(lf_save() == LF_RESULT_SUCCESS);
+        *ops += 1;
+    }
+    return true;
+}
+
+// ---- runner ----
+
+struct Workload {
+    const char *name;
+    bool (*run)(unsigned long *ops);
+};
+
+int main(int argc, char *argv[])
+{
+    const memory_profile *profile = &MEMORY_PROFILE_NOR;
+    if(argc > 1)
+    {
+        string name = argv[1];
+        if(name == "nor") profile = &MEMORY_PROFILE_NOR;
+        else if(name == "nand") profile = &MEMORY_PROFILE_NAND;
+        else if(name == "eeprom") profile = &MEMORY_PROFILE_EEPROM;
+        else
+        {
+            cout << "usage: benchmark [nor|nand|eeprom]" << endl;
+            return 1;
+        }
+    }
+    memory_set_profile(*profile);
+
+    Workload workloads[] = {
+        {"small file churn", smallFileChurn},
+        {"large sequential", largeSequential},
+        {"random seek", randomSeek},
+        {"append logging", appendLogging},
+        {"near full", nearFull},
+    };
+
+    for(size_t i = 0; i < buffer.size(); ++i)
+    {
+        buffer[i] = (uint8_t)i;
+    }
+
+    printf("memory: %u blocks x %u bytes, page %u bytes, %s timing\n\n", blockCount, blockSize, pageSize, profile->name);
+    printf("%-18s %8s %10s %10s %8s %12s %12s %8s %10s %12s\n",
+        "workload", "ops", "reads", "writes", "erases", "bytes read", "bytes writ.", "blk ers.", "time [ms]", "device [ms]");
+
+    for(Workload &workload : workloads)
+    {
+        memory.assign((size_t)blockCount * blockSize, 0xff);
+        memory_config(memory.data(), blockCount, blockSize, pageSize);
+        generator.seed(1);
+
+        if(lf_init() != LF_RESULT_SUCCESS)
+        {
+            cout << "Could not init the library." << endl;
+            return 1;
+        }
+
+        unsigned long ops = 0;
+        memory_reset_stats();
+        auto start = chrono::steady_clock::now();
+        bool ok = workload.run(&ops);
+        auto end = chrono::steady_clock::now();
+        if(!ok)
+        {
+            return 1;
+        }
+
+        memory_stats stats = memory_get_stats();
+        printf("%-18s %8lu %10llu %10llu %8llu %12llu %12llu %8llu %10.2f %12.1f\n",
+            workload.name, ops,
+            (unsigned long long)stats.readCalls, (unsigned long long)stats.writeCalls, (unsigned long long)stats.eraseCalls,
+            (unsigned long long)stats.bytesRead, (unsigned long long)stats.bytesWritten, (unsigned long long)stats.blocksErased,
+            chrono::duration<double, milli>(end - start).count(), stats.deviceTimeUs / 1000);
+    }
+
+    return 0;
+}
@@ -1,18 +1,244 @@
 #include <cstdint>
 #include <cstring>
+#include <vector>
+#include <mutex>
+#include <thread>
 #include "memory_impl.hpp"
 
-static struct {
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+LF_STATE struct {
     uint8_t *ptr;
     uint16_t blockCount;
     uint16_t blockSize;
+    uint16_t pageSize;
+    uint8_t flags;
+    uint8_t deviceCount;
 } memoryConfig;
 
-void memory_config(uint8_t *ptr, uint16_t blockCount, uint16_t blockSize)
+// erase state of the blocks
+LF_STATE std::vector<uint32_t> eraseCounts;
+LF_STATE std::vector<bool> erased;
+LF_STATE std::vector<bool> bad;
+
+LF_STATE memory_stats stats;
+
+const memory_profile MEMORY_PROFILE_INSTANT = {"instant", 0, 0, 0, 0};
+const memory_profile MEMORY_PROFILE_NOR = {"NOR", 5, 0.2, 2.7, 45000};
+const memory_profile MEMORY_PROFILE_NAND = {"NAND", 60, 0.05, 0.15, 2000};
+const memory_profile MEMORY_PROFILE_EEPROM = {"EEPROM", 0.5, 0.5, 3300, 128 * 3300};
+
+LF_STATE memory_profile profile = MEMORY_PROFILE_INSTANT;
+
+// the driver calls can come from several threads
+LF_STATE std::mutex busMutex;
+#if LF_USE_LOCK
+LF_STATE std::mutex libraryMutex;
+#endif
+
+// busy state of the device
+LF_STATE unsigned latency;
+LF_STATE unsigned busyPolls;
+
+// mapped image file
+LF_STATE struct {
+    uint8_t *ptr;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int file;
+#endif
+} image;
+
+static void memory_set(uint8_t *ptr, uint16_t blockCount, uint16_t blockSize, uint16_t pageSize, uint8_t flags)
 {
+    memoryConfig.flags = flags;
     memoryConfig.ptr = ptr;
     memoryConfig.blockCount = blockCount;
     memoryConfig.blockSize = blockSize;
+    memoryConfig.pageSize = pageSize;
+    memoryConfig.deviceCount = 1;
+
+    memory_reset_stats();
+    eraseCounts.assign(blockCount, 0);
+    erased.assign(blockCount, false);
+    bad.assign(blockCount, false);
+    for(uint16_t block = 0; block < blockCount; ++block)
+    {
+        // the block is erased if all its bytes are 0xff
+        uint8_t *p = ptr + ((size_t)block*blockSize);
+        erased[block] = (p[0] == 0xff) && (memcmp(p, p + 1, blockSize - 1) == 0);
+    }
+}
+
+void memory_config(uint8_t *ptr, uint16_t blockCount, uint16_t blockSize, uint16_t pageSize, uint8_t flags)
+{
+    memory_close_image();
+    memory_set(ptr, blockCount, blockSize, pageSize, flags);
+}
+
+bool memory_open_image(const char *path, uint16_t blockCount, uint16_t blockSize, uint16_t pageSize, uint8_t flags)
+{
+    memory_close_image();
+
+    size_t size = (size_t)blockCount * blockSize;
+    size_t oldSize;
+    uint8_t *ptr;
+
+#ifdef _WIN32
+    image.file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(image.file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(image.file, &fileSize))
+    {
+        CloseHandle(image.file);
+        return false;
+    }
+    oldSize = (size_t)fileSize.QuadPart;
+    uint64_t mappingSize = (oldSize > size) ? oldSize : size;
+    image.mapping = CreateFileMappingA(image.file, NULL, PAGE_READWRITE, (DWORD)(mappingSize >> 32), (DWORD)mappingSize, NULL);
+    if(image.mapping == NULL)
+    {
+        CloseHandle(image.file);
+        return false;
+    }
+    ptr = (uint8_t*)MapViewOfFile(image.mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if(ptr == NULL)
+    {
+        CloseHandle(image.mapping);
+        CloseHandle(image.file);
+        return false;
+    }
+#else
+    image.file = open(path, O_RDWR | O_CREAT, 0644);
+    if(image.file < 0) return false;
+    struct stat fileStat;
+    if(fstat(image.file, &fileStat) != 0 || ((size_t)fileStat.st_size < size && ftruncate(image.file, size) != 0))
+    {
+        close(image.file);
+        return false;
+    }
+    oldSize = (size_t)fileStat.st_size;
+    ptr = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, image.file, 0);
+    if(ptr == MAP_FAILED)
+    {
+        close(image.file);
+        return false;
+    }
+#endif
+
+    image.ptr = ptr;
+    image.size = size;
+
+    // a new (or extended) part of the image is erased
+    if(oldSize < size)
+    {
+        memset(ptr + oldSize, 0xff, size - oldSize);
+    }
+
+    memory_set(ptr, blockCount, blockSize, pageSize, flags);
+    return true;
+}
+
+void memory_close_image()
+{
+    if(image.ptr == NULL) return;
+
+#ifdef _WIN32
+    FlushViewOfFile(image.ptr, image.size);
+    UnmapViewOfFile(image.ptr);
+    CloseHandle(image.mapping);
+    CloseHandle(image.file);
+#else
+    msync(image.ptr, image.size, MS_SYNC);
+    munmap(image.ptr, image.size);
+    close(image.file);
+#endif
+
+    if(memoryConfig.ptr == image.ptr)
+    {
+        memoryConfig.ptr = NULL;
+        memoryConfig.blockCount = 0;
+    }
+    image.ptr = NULL;
+}
+
+uint32_t memory_erase_count(uint16_t block)
+{
+    return (block < eraseCounts.size()) ? eraseCounts[block] : 0;
+}
+
+bool memory_is_erased(uint16_t block)
+{
+    return (block < erased.size()) ? erased[block] : false;
+}
+
+void memory_set_device_count(uint8_t count)
+{
+    memoryConfig.deviceCount = count;
+}
+
+void memory_set_bad(uint16_t block, bool isBad)
+{
+    if(block < bad.size())
+    {
+        bad[block] = isBad;
+    }
+}
+
+void memory_set_profile(const memory_profile &newProfile)
+{
+    profile = newProfile;
+}
+
+void memory_set_latency(unsigned polls)
+{
+    latency = polls;
+    busyPolls = 0;
+}
+
+bool memory_ready()
+{
+    std::lock_guard<std::mutex> bus(busMutex);
+    if(busyPolls != 0)
+    {
+        --busyPolls;
+        return false;
+    }
+    return true;
+}
+
+memory_stats memory_get_stats()
+{
+    return stats;
+}
+
+void memory_reset_stats()
+{
+    stats = memory_stats();
+}
+
+static void erase_blocks(uint16_t block, uint16_t count)
+{
+    ++stats.eraseCalls;
+    busyPolls = latency;
+    stats.blocksErased += count;
+    stats.deviceTimeUs += profile.transactionUs + count * profile.eraseBlockUs;
+    memset(memoryConfig.ptr + ((size_t)block*memoryConfig.blockSize), 0xff, (size_t)count*memoryConfig.blockSize);
+    for(uint16_t i = block; i < block + count; ++i)
+    {
+        ++eraseCounts[i];
+        erased[i] = true;
+    }
 }
 
 // ---------------- driver implementation ---------------------
@@ -21,30 +247,131 @@ lf_result_t lf_app_init(lf_memory_config *config)
 {
     config->blockCount = memoryConfig.blockCount;
     config->blockSize = memoryConfig.blockSize;
+    config->pageSize = memoryConfig.pageSize;
+    config->flags = memoryConfig.flags;
+    config->deviceCount = memoryConfig.deviceCount;
     return LF_RESULT_SUCCESS;
 }
 
-lf_result_t lf_app_write(uint16_t block, uint16_t offset, void *buffer, unsigned int length, uint8_t flush)
+lf_result_t lf_app_write(uint16_t block, uint16_t offset, void *buffer, size_t length, uint8_t flush)
 {
+    (void)flush; // the simulated memory is programmed at once
+    std::lock_guard<std::mutex> bus(busMutex);
     if(block >= memoryConfig.blockCount) return LF_RESULT_FAILED;
-    uint8_t *p = memoryConfig.ptr + (block*memoryConfig.blockSize) + offset;
-    for(int i = 0; i < length; ++i)
+    // a program operation can not cross a page boundary
+    if(memoryConfig.pageSize != 0 && (offset % memoryConfig.pageSize) + length > memoryConfig.pageSize) return LF_RESULT_FAILED;
+    if(bad[block]) return LF_RESULT_BAD_BLOCK;
+    ++stats.writeCalls;
+    busyPolls = latency;
+    stats.bytesWritten += length;
+    stats.deviceTimeUs += profile.transactionUs;
+    uint8_t *p = memoryConfig.ptr + ((size_t)block*memoryConfig.blockSize) + offset;
+    for(size_t i = 0; i < length; ++i)
+    {
+        if(memoryConfig.flags & LF_MEMORY_FLAG_REWRITABLE)
+        {
+            // unchanged bytes are skipped
+            if(p[i] != ((uint8_t*)buffer)[i])
+            {
+                stats.deviceTimeUs += profile.programByteUs;
+            }
+            p[i] = ((uint8_t*)buffer)[i];
+        }
+        else
+        {
+            // NOR flash can only clear bits
+            stats.deviceTimeUs += profile.programByteUs;
+            p[i] &= ((uint8_t*)buffer)[i];
+        }
+    }
+    if(length != 0)
     {
-        p[i] &= ((uint8_t*)buffer)[i];
+        erased[block] = false;
     }
     return LF_RESULT_SUCCESS;
 }
 
-lf_result_t lf_app_read(uint16_t block, uint16_t offset, void *buffer, unsigned int length)
+lf_result_t lf_app_read(uint16_t block, uint16_t offset, void *buffer, size_t length)
 {
+    std::lock_guard<std::mutex> bus(busMutex);
     if(block >= memoryConfig.blockCount) return LF_RESULT_FAILED;
-    memcpy(buffer, memoryConfig.ptr + (block*memoryConfig.blockSize) + offset, length);
+    ++stats.readCalls;
+    busyPolls = latency;
+    stats.bytesRead += length;
+    stats.deviceTimeUs += profile.transactionUs + length * profile.readByteUs;
+    memcpy(buffer, memoryConfig.ptr + ((size_t)block*memoryConfig.blockSize) + offset, length);
     return LF_RESULT_SUCCESS;
 }
 
 lf_result_t lf_app_delete(uint16_t block)
 {
+    std::lock_guard<std::mutex> bus(busMutex);
     if(block >= memoryConfig.blockCount) return LF_RESULT_FAILED;
-    memset(memoryConfig.ptr + (block*memoryConfig.blockSize), 0xff, memoryConfig.blockSize);
+    if(bad[block]) return LF_RESULT_BAD_BLOCK;
+    erase_blocks(block, 1);
     return LF_RESULT_SUCCESS;
 }
+
+lf_result_t lf_app_erase_range(uint16_t block, uint16_t count)
+{
+    std::lock_guard<std::mutex> bus(busMutex);
+    if(block + count > memoryConfig.blockCount) return LF_RESULT_FAILED;
+    // the good blocks of the range are erased
+    lf_result_t result = LF_RESULT_SUCCESS;
+    for(uint16_t i = block; i < block + count; ++i)
+    {
+        if(bad[i]) result = LF_RESULT_BAD_BLOCK;
+    }
+    if(result == LF_RESULT_SUCCESS)
+    {
+        erase_blocks(block, count);
+        return result;
+    }
+    for(uint16_t i = block; i < block + count; ++i)
+    {
+        if(!bad[i]) erase_blocks(i, 1);
+    }
+    return result;
+}
+
+const void *lf_app_map(uint16_t block)
+{
+    if(block >= memoryConfig.blockCount) return NULL;
+    return memoryConfig.ptr + ((size_t)block*memoryConfig.blockSize);
+}
+
+#if LF_USE_LOCK
+void lf_app_lock(void)
+{
+    libraryMutex.lock();
+}
+
+void lf_app_unlock(void)
+{
+    libraryMutex.unlock();
+}
+#endif
+
+#if LF_USE_TAIL
+void lf_app_wait(void)
+{
+    std::this_thread::yield();
+}
+#endif
+
+#if LF_USE_CRC && LF_CRC_METHOD == LF_CRC_DRIVER
+// a hardware CRC unit computes the same checksum
+uint32_t lf_app_crc32(uint32_t crc, const void *data, size_t length)
+{
+    crc = ~crc;
+    for(size_t i = 0; i < length; ++i)
+    {
+        crc ^= ((const uint8_t*)data)[i];
+        for(int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xedb88320u) : (crc >> 1);
+        }
+    }
+    return ~crc;
+}
+#endif
@@ -2,4 +2,63 @@
 
 #include "light_files.h"
 
-void memory_config(uint8_t *ptr, uint16_t blockCount, uint16_t blockSize);
\ No newline at end of file
+// The state of the simulator has the storage class LF_STATE as the state of the library, so built
+// with LF_STATE defined as 'static thread_local' each thread simulates its own memory.
+
+// driver activity since the memory was configured
+struct memory_stats {
+    uint64_t readCalls = 0;
+    uint64_t writeCalls = 0;
+    uint64_t eraseCalls = 0; // lf_app_delete and lf_app_erase_range calls
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t blocksErased = 0;
+    double deviceTimeUs = 0; // estimated time the real device would need, see memory_profile
+};
+
+// timing of a memory device, used to estimate the time of the driver calls
+struct memory_profile {
+    const char *name;
+    double transactionUs; // setup of each read, write or erase (command, address, busy polling)
+    double readByteUs;
+    double programByteUs; // on rewritable memories only the bytes that change are counted
+    double eraseBlockUs;
+};
+
+extern const memory_profile MEMORY_PROFILE_INSTANT; // default, all the operations take no time
+extern const memory_profile MEMORY_PROFILE_NOR; // SPI NOR flash, 4 kB sectors
+extern const memory_profile MEMORY_PROFILE_NAND; // SPI NAND flash, 2 kB pages, 128 kB blocks
+extern const memory_profile MEMORY_PROFILE_EEPROM; // AVR internal EEPROM, 128 B blocks erased by writing
+
+// the profile is used until it is changed, also when the memory is reconfigured
+void memory_set_profile(const memory_profile &profile);
+
+// after each driver call the device stays busy for 'polls' calls of memory_ready (0 by default),
+// used to simulate a device completing the operations asynchronously
+void memory_set_latency(unsigned polls);
+// false while the device is busy
+bool memory_ready();
+
+// uses the array 'ptr' as the memory
+void memory_config(uint8_t *ptr, uint16_t blockCount, uint16_t blockSize, uint16_t pageSize = 0, uint8_t flags = 0);
+
+// number of devices reported by lf_app_init (LF_USE_STRIPING), the array holds their blocks
+// interleaved as the library numbers them, reset to 1 when the memory is configured
+void memory_set_device_count(uint8_t count);
+
+// maps the flash image file 'path' as the memory, a new (or extended) part of the image is erased
+bool memory_open_image(const char *path, uint16_t blockCount, uint16_t blockSize, uint16_t pageSize = 0, uint8_t flags = 0);
+// unmaps the image, its content stays in the file
+void memory_close_image();
+
+// number of erases of the block since the memory was configured
+uint32_t memory_erase_count(uint16_t block);
+// true if the block was not programmed since its last erase
+bool memory_is_erased(uint16_t block);
+
+// the program and erase operations of a bad block fail with LF_RESULT_BAD_BLOCK and do not change it,
+// as on a worn out NAND block (all the blocks are good after the memory is configured)
+void memory_set_bad(uint16_t block, bool bad);
+
+memory_stats memory_get_stats();
+void memory_reset_stats();
@@ -0,0 +1,266 @@
+// Stress test and scaling benchmark of the library on the host.
+// Each thread runs its own instance of the library on its own simulated memory
+// with a random workload, which is checked against a model of the files. The
+// workload of an instance depends only on its seed, so a failing instance is
+// replayed (e.g. in a debugger) by running a single thread with its seed.
+//
+// usage: stress [-t <threads>] [-n <operations per thread>] [-s <seed>]
+//   instance i uses the seed 'seed + i' (1 by default)
+//
+// Shall be built with LF_STATE defined as 'static thread_local', e.g.:
+//   g++ -std=c++17 -O2 stress.cpp memory_impl.cpp ../../sources/light_files.c -I../../sources "-DLF_STATE=static thread_local" -pthread
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "light_files.h"
+#include "memory_impl.hpp"
+
+using namespace std;
+
+static const uint16_t blockSize = 512;
+static const uint16_t blockCount = 256;
+static const uint16_t pageSize = 64;
+
+static const int keys = 32;
+static const size_t maxFileSize = 2048; // all the files fit in the memory at the same time
+
+enum Operation { OP_WRITE, OP_READ, OP_SEEK, OP_SIZE, OP_DELETE, OP_REMOUNT, OP_COUNT };
+static const char *operationNames[OP_COUNT] = {"write", "read", "seek", "size", "delete", "remount"};
+
+struct Instance {
+    uint32_t seed;
+    unsigned long operations;
+    int failedLine = 0; // line of the failed check
+    unsigned long failedOperation = 0;
+    uint32_t checksum = 0; // of the memory at the end
+    vector<uint32_t> latencies[OP_COUNT]; // in ns
+};
+
+// byte 'i' of the content of version 'version' of the file 'key'
+static uint8_t content(int key, uint32_t version, size_t i)
+{
+    uint32_t x = (uint32_t)key * 0x9e3779b9u ^ version * 0x85ebca6bu ^ (uint32_t)i * 0xc2b2ae35u;
+    x ^= x >> 15;
+    return (uint8_t)(x * 0x2c1b3c6du >> 24);
+}
+
+#define S_ASSERT(cond) if(!(cond)) {return __LINE__;}
+
+// runs 'operation' on the instance, returns 0 or the line of the failed check
+static int run(mt19937 &generator, Operation operation, vector<uint32_t> &versions, vector<size_t> &sizes)
+{
+    static thread_local uint8_t buffer[maxFileSize];
+    int key = generator() % keys;
+    bool exists = sizes[key] != 0;
+
+    switch(operation)
+    {
+    case OP_WRITE:
+    {
+        if(exists)
+        {
+            S_ASSERT(lf_delete(key) == LF_RESULT_SUCCESS);
+        }
+        uint32_t version = ++versions[key];
+        size_t size = 1 + generator() % maxFileSize;
+        for(size_t i = 0; i < size; ++i)
+        {
+            buffer[i] = content(key, version, i);
+        }
+        S_ASSERT(lf_create(key) == LF_RESULT_SUCCESS);
+        for(size_t written = 0; written < size;)
+        {
+            size_t length = min(size - written, (size_t)(1 + generator() % 300));
+            S_ASSERT(lf_write(buffer + written, length) == LF_RESULT_SUCCESS);
+            written += length;
+        }
+        S_ASSERT(lf_save() == LF_RESULT_SUCCESS);
+        sizes[key] = size;
+        break;
+    }
+    case OP_READ:
+        if(!exists)
+        {
+            S_ASSERT(lf_exists(key) != LF_RESULT_SUCCESS);
+            break;
+        }
+        S_ASSERT(lf_open(key) == LF_RESULT_SUCCESS);
+        S_ASSERT(lf_read(buffer, sizes[key]) == LF_RESULT_SUCCESS);
+        S_ASSERT(lf_close() == LF_RESULT_SUCCESS);
+        for(size_t i = 0; i < sizes[key]; ++i)
+        {
+            S_ASSERT(buffer[i] == content(key, versions[key], i));
+        }
+        break;
+    case OP_SEEK:
+    {
+        if(!exists)
+        {
+            break;
+        }
+        size_t position = generator() % sizes[key];
+        size_t length = min(sizes[key] - position, (size_t)16);
+        S_ASSERT(lf_open(key) == LF_RESULT_SUCCESS);
+        S_ASSERT(lf_read(NULL, position) == LF_RESULT_SUCCESS);
+        S_ASSERT(lf_read(buffer, length) == LF_RESULT_SUCCESS);
+        S_ASSERT(lf_close() == LF_RESULT_SUCCESS);
+        for(size_t i = 0; i < length; ++i)
+        {
+            S_ASSERT(buffer[i] == content(key, versions[key], position + i));
+        }
+        break;
+    }
+    case OP_SIZE:
+    {
+        uint32_t size = 0;
+        S_ASSERT((lf_size(key, &size) == LF_RESULT_SUCCESS) == exists);
+        S_ASSERT(!exists || size == sizes[key]);
+        break;
+    }
+    case OP_DELETE:
+        S_ASSERT((lf_delete(key) == LF_RESULT_SUCCESS) == exists);
+        sizes[key] = 0;
+        break;
+    case OP_REMOUNT:
+        S_ASSERT(lf_init() == LF_RESULT_SUCCESS);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static void runInstance(Instance *instance)
+{
+    vector<uint8_t> memory((size_t)blockCount * blockSize, 0xff);
+    memory_config(memory.data(), blockCount, blockSize, pageSize);
+    if(lf_init() != LF_RESULT_SUCCESS)
+    {
+        instance->failedLine = __LINE__;
+        return;
+    }
+
+    mt19937 generator(instance->seed);
+    vector<uint32_t> versions(keys, 0);
+    vector<size_t> sizes(keys, 0); // 0 if the file does not exist
+
+    for(unsigned long i = 0; i < instance->operations; ++i)
+    {
+        // mostly reads, as on a device
+        unsigned r = generator() % 100;
+        Operation operation = r < 30 ? OP_WRITE : r < 60 ? OP_READ : r < 80 ? OP_SEEK : r < 90 ? OP_SIZE : r < 99 ? OP_DELETE : OP_REMOUNT;
+
+        auto start = chrono::steady_clock::now();
+        int line = run(generator, operation, versions, sizes);
+        auto end = chrono::steady_clock::now();
+        if(line != 0)
+        {
+            instance->failedLine = line;
+            instance->failedOperation = i;
+            return;
+        }
+        instance->latencies[operation].push_back((uint32_t)chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+    }
+
+    // FNV-1a of the memory, equal in each run with the same seed
+    uint32_t checksum = 0x811c9dc5u;
+    for(uint8_t byte : memory)
+    {
+        checksum = (checksum ^ byte) * 0x01000193u;
+    }
+    instance->checksum = checksum;
+}
+
+// percentile 'p' of the sorted latencies, in us
+static double percentile(const vector<uint32_t> &sorted, double p)
+{
+    return sorted.empty() ? 0 : sorted[min(sorted.size() - 1, (size_t)(p * sorted.size()))] / 1000.0;
+}
+
+static int usage()
+{
+    cout << "usage: stress [-t <threads>] [-n <operations per thread>] [-s <seed>]" << endl;
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long threads = 4, operations = 100000, seed = 1;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) threads = strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) operations = strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = strtoul(argv[++i], NULL, 0);
+        else return usage();
+    }
+    if(threads == 0)
+    {
+        return usage();
+    }
+
+    vector<Instance> instances(threads);
+    for(unsigned long i = 0; i < threads; ++i)
+    {
+        instances[i].seed = (uint32_t)(seed + i);
+        instances[i].operations = operations;
+    }
+
+    printf("%lu instances x %lu operations, memory: %u blocks x %u bytes, page %u bytes\n\n", threads, operations, blockCount, blockSize, pageSize);
+
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for(Instance &instance : instances)
+    {
+        workers.emplace_back(runInstance, &instance);
+    }
+    for(thread &worker : workers)
+    {
+        worker.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    for(Instance &instance : instances)
+    {
+        if(instance.failedLine != 0)
+        {
+            printf("instance with seed %u failed at line %d in operation %lu, replay with: stress -t 1 -n %lu -s %u\n",
+                instance.seed, instance.failedLine, instance.failedOperation, instance.failedOperation + 1, instance.seed);
+            ++failed;
+        }
+    }
+    if(failed != 0)
+    {
+        return 1;
+    }
+
+    printf("%-8s %10s %10s %10s %10s %10s\n", "op", "count", "p50 [us]", "p90 [us]", "p99 [us]", "max [us]");
+    unsigned long long total = 0;
+    for(int operation = 0; operation < OP_COUNT; ++operation)
+    {
+        vector<uint32_t> latencies;
+        for(Instance &instance : instances)
+        {
+            latencies.insert(latencies.end(), instance.latencies[operation].begin(), instance.latencies[operation].end());
+        }
+        sort(latencies.begin(), latencies.end());
+        total += latencies.size();
+        printf("%-8s %10zu %10.2f %10.2f %10.2f %10.2f\n", operationNames[operation], latencies.size(),
+            percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99), percentile(latencies, 1.0));
+    }
+    printf("\n%llu operations in %.2f s, %.0f ops/s\n", total, seconds, total / seconds);
+
+    // the same seed gives the same checksum on each run, with any number of threads
+    for(Instance &instance : instances)
+    {
+        printf("seed %u: memory checksum %08x\n", instance.seed, instance.checksum);
+    }
+    return 0;
+}
@@ -0,0 +1,371 @@
+// lfinfo - prints the files, free space and fragmentation of a LightFiles memory image
+//
+// usage: lfinfo -b <block size> [-n <block count>] [-v] <image>
+//   -n  number of blocks, by default the whole image is used
+//   -v  prints the chain of blocks of each file
+//
+// The image is not modified.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <filesystem>
+#include "light_files.h"
+#include "memory_impl.hpp"
+
+using namespace std;
+
+// block format, see light_files.c
+static const size_t headerSize = 5 + (LF_USE_CRC ? 4 : 0);
+static const size_t leadingHeaderSize = headerSize + (LF_USE_RECORDS ? 7 : ((LF_USE_COMPRESSION || LF_USE_TRANSACTIONS) ? 5 : 0)); // with the file attributes
+static const uint16_t blockNone = 0xffff;
+static const uint8_t keyFree = 0xff;
+static const uint8_t leadingMask = 0x80;
+static const uint8_t infoSystem = 0x7f; // log block of the key-value store, a commit or swap record or the bad block table
+static const uint16_t systemCommit = 0x0000; // in the size field of the commit record
+static const uint16_t systemBadBlocks = 0xfffe; // in the size field of the bad block table
+static const uint16_t systemSwap = 0xfffd; // in the size field of the swap record of a copied file
+static const uint8_t flagCompressed = 0x01;
+static const uint8_t flagPending = 0x02;
+static const uint8_t flagCommitted = 0x04;
+static const uint32_t sizeUnknown = 0xffffffff;
+static const uint16_t recordSizeNone = 0xffff;
+
+struct Header {
+    uint8_t info;
+    uint16_t nextBlock;
+    uint16_t size;
+    uint32_t crc; // with LF_USE_CRC only
+    uint8_t flags; // leading blocks with the file attributes only
+    uint32_t contentSize;
+    uint16_t recordSize; // 0xffff if the file is not a record file
+};
+
+// CRC-32 as computed by the library, continuing 'crc'
+static uint32_t crc32(uint32_t crc, const void *data, size_t length)
+{
+    crc = ~crc;
+    for(size_t i = 0; i < length; ++i)
+    {
+        crc ^= ((const uint8_t*)data)[i];
+        for(int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xedb88320u) : (crc >> 1);
+        }
+    }
+    return ~crc;
+}
+
+// checks the data of a block against the CRC in its header
+static bool block_valid(uint16_t block, const Header &header, size_t dataOffset)
+{
+    vector<uint8_t> data(header.size);
+    if(lf_app_read(block, (uint16_t)dataOffset, data.data(), data.size()) != LF_RESULT_SUCCESS)
+    {
+        return false;
+    }
+    uint16_t link[2] = {header.nextBlock, header.size};
+    uint32_t crc = crc32(crc32(0, data.data(), data.size()), link, sizeof(link));
+    return crc == header.crc;
+}
+
+static int usage()
+{
+    cerr << "usage: lfinfo -b <block size> [-n <block count>] [-v] <image>" << endl;
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long blockSize = 0, blockCount = 0;
+    bool verbose = false;
+    const char *path = NULL;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) blockSize = strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) blockCount = strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-v") == 0) verbose = true;
+        else if(argv[i][0] == '-' || path != NULL) return usage();
+        else path = argv[i];
+    }
+    if(path == NULL || blockSize <= leadingHeaderSize || blockSize > 0xffff)
+    {
+        return usage();
+    }
+
+    error_code ec;
+    uintmax_t imageSize = std::filesystem::file_size(path, ec);
+    if(ec)
+    {
+        cerr << "error: can not open image " << path << endl;
+        return 1;
+    }
+    if(blockCount == 0)
+    {
+        blockCount = imageSize / blockSize;
+    }
+    if(blockCount == 0 || blockCount >= 0xffff || blockCount * blockSize > imageSize)
+    {
+        cerr << "error: image is too small for " << blockCount << " blocks" << endl;
+        return 1;
+    }
+
+    if(!memory_open_image(path, (uint16_t)blockCount, (uint16_t)blockSize))
+    {
+        cerr << "error: can not open image " << path << endl;
+        return 1;
+    }
+
+    // read all the headers
+    vector<Header> headers(blockCount);
+    for(uint16_t block = 0; block < blockCount; ++block)
+    {
+        uint8_t raw[leadingHeaderSize];
+        if(lf_app_read(block, 0, raw, leadingHeaderSize) != LF_RESULT_SUCCESS)
+        {
+            cerr << "error: can not read block " << block << endl;
+            return 1;
+        }
+        headers[block].info = raw[0];
+        memcpy(&headers[block].nextBlock, raw + 1, 2);
+        memcpy(&headers[block].size, raw + 3, 2);
+        memcpy(&headers[block].crc, raw + 5, LF_USE_CRC ? 4 : 0);
+        headers[block].flags = 0;
+        headers[block].contentSize = sizeUnknown;
+        headers[block].recordSize = recordSizeNone;
+        if(leadingHeaderSize > headerSize)
+        {
+            headers[block].flags = (uint8_t)~raw[headerSize];
+            memcpy(&headers[block].contentSize, raw + headerSize + 1, 4);
+            memcpy(&headers[block].recordSize, raw + headerSize + 5, LF_USE_RECORDS ? 2 : 0);
+        }
+    }
+
+    // the retired blocks, the driver calls of the library are redirected to their replacements
+    vector<bool> bad(blockCount, false);
+    vector<uint16_t> replacement(blockCount, blockNone);
+    size_t tableBlocks = 0;
+    for(uint16_t block = 0; LF_USE_BAD_BLOCKS && block < blockCount; ++block)
+    {
+        if(headers[block].info != infoSystem || headers[block].size != systemBadBlocks)
+        {
+            continue;
+        }
+        ++tableBlocks;
+        for(size_t offset = headerSize; offset + 4 <= blockSize; offset += 4)
+        {
+            uint16_t entry[2];
+            if(lf_app_read(block, (uint16_t)offset, entry, sizeof(entry)) != LF_RESULT_SUCCESS || entry[0] == blockNone)
+            {
+                break;
+            }
+            if(entry[0] < blockCount)
+            {
+                bad[entry[0]] = true;
+                replacement[entry[0]] = entry[1];
+            }
+        }
+    }
+    auto remap = [&](uint16_t block)
+    {
+        // a replacement can be retired as well
+        for(size_t i = 0; i < blockCount && block < blockCount && replacement[block] != blockNone; ++i)
+        {
+            block = replacement[block];
+        }
+        return block;
+    };
+
+    // follow the chains of the files
+    vector<bool> reached(blockCount, false);
+    size_t fileCount = 0, fileBlocks = 0, fragmentedFiles = 0, totalFragments = 0;
+    uint64_t totalSize = 0;
+    size_t maxContentSize = blockSize - headerSize;
+
+    cout << "key      size  blocks  fragments" << (LF_USE_COMPRESSION ? "    content" : "") << (verbose ? "  chain" : "") << endl;
+    for(uint16_t first = 0; first < blockCount; ++first)
+    {
+        uint8_t info = headers[first].info;
+        if(info == keyFree || !(info & leadingMask) || bad[first])
+        {
+            continue;
+        }
+
+        uint8_t key = info & ~leadingMask;
+        uint64_t size = 0;
+        size_t blocks = 0, fragments = 1;
+        bool open = false, broken = false, corrupted = false;
+        string chain;
+
+        uint16_t block = first;
+        while(1)
+        {
+            uint8_t blockInfo = headers[block].info;
+            if(reached[block] || (block != first && (blockInfo == keyFree || blockInfo == infoSystem || (blockInfo & leadingMask))))
+            {
+                // loop, shared block, or a block which is not a following one (the following
+                // blocks of a renamed file keep the old key)
+                broken = true;
+                break;
+            }
+            reached[block] = true;
+            ++blocks;
+            if(verbose)
+            {
+                chain += (chain.empty() ? "" : " ") + to_string(block);
+            }
+
+            uint16_t blockDataSize = headers[block].size;
+            if(blockDataSize > maxContentSize - ((block == first) ? leadingHeaderSize - headerSize : 0))
+            {
+                // size is not written until the file is saved
+                open = true;
+                break;
+            }
+            size += blockDataSize;
+            if(LF_USE_CRC && !block_valid(block, headers[block], (block == first) ? leadingHeaderSize : headerSize))
+            {
+                corrupted = true;
+            }
+
+            uint16_t next = headers[block].nextBlock;
+            if(next == blockNone)
+            {
+                break;
+            }
+            if(next >= blockCount)
+            {
+                broken = true;
+                break;
+            }
+            if(next != block + 1)
+            {
+                ++fragments;
+            }
+            block = remap(next);
+            if(block >= blockCount)
+            {
+                broken = true;
+                break;
+            }
+        }
+
+        ++fileCount;
+        fileBlocks += blocks;
+        totalSize += size;
+        totalFragments += fragments;
+        if(fragments > 1)
+        {
+            ++fragmentedFiles;
+        }
+
+        printf("%3u %9llu %7zu %10zu", key, (unsigned long long)size, blocks, fragments);
+        if(LF_USE_COMPRESSION && headers[first].contentSize != sizeUnknown)
+        {
+            // size of the content before compression
+            printf(" %10lu%s", (unsigned long)headers[first].contentSize, (headers[first].flags & flagCompressed) ? " (compressed)" : "");
+        }
+        if(LF_USE_RECORDS && headers[first].recordSize != recordSizeNone)
+        {
+            printf("  (%u byte records)", headers[first].recordSize);
+        }
+        if(LF_USE_TRANSACTIONS && (headers[first].flags & flagPending) && !(headers[first].flags & flagCommitted))
+        {
+            cout << "  (pending)";
+        }
+        cout << (open ? "  (not saved)" : "") << (broken ? "  (broken chain)" : "") << (corrupted ? "  (corrupted)" : "");
+        if(verbose)
+        {
+            cout << "  " << chain;
+        }
+        cout << endl;
+    }
+
+    // free space and lost blocks
+    size_t freeBlocks = 0, freeRuns = 0, largestFreeRun = 0, run = 0, orphanBlocks = 0, kvBlocks = 0, commitRecords = 0, swapRecords = 0, badBlocks = 0, replacedBlocks = 0;
+    for(uint16_t block = 0; block < blockCount; ++block)
+    {
+        if(bad[block])
+        {
+            run = 0;
+            ++badBlocks;
+            replacedBlocks += replacement[block] != blockNone;
+        }
+        else if(headers[block].info == keyFree)
+        {
+            ++freeBlocks;
+            if(run++ == 0)
+            {
+                ++freeRuns;
+            }
+            if(run > largestFreeRun)
+            {
+                largestFreeRun = run;
+            }
+        }
+        else
+        {
+            run = 0;
+            if(headers[block].info == infoSystem && headers[block].size == systemCommit)
+            {
+                ++commitRecords;
+            }
+            else if(headers[block].info == infoSystem && headers[block].size == systemSwap)
+            {
+                ++swapRecords;
+            }
+            else if(headers[block].info == infoSystem && headers[block].size == systemBadBlocks)
+            {
+                // the bad block table, see below
+            }
+            else if(headers[block].info == infoSystem)
+            {
+                ++kvBlocks;
+            }
+            else if(!reached[block])
+            {
+                ++orphanBlocks;
+            }
+        }
+    }
+
+    memory_close_image();
+
+    cout << endl;
+    cout << "blocks:        " << blockCount << " x " << blockSize << " bytes" << endl;
+    cout << "files:         " << fileCount << ", " << totalSize << " bytes in " << fileBlocks << " blocks" << endl;
+    if(fileBlocks != 0)
+    {
+        cout << "efficiency:    " << (100.0 * totalSize / ((double)fileBlocks * blockSize)) << "% of the used blocks hold data" << endl;
+    }
+    cout << "free:          " << freeBlocks << " blocks (" << (uint64_t)freeBlocks * maxContentSize << " bytes of content) in " << freeRuns << " runs, largest run " << largestFreeRun << " blocks" << endl;
+    cout << "fragmentation: " << fragmentedFiles << " of " << fileCount << " files fragmented";
+    if(fileCount != 0)
+    {
+        cout << ", " << (double)totalFragments / fileCount << " fragments per file";
+    }
+    cout << endl;
+    if(kvBlocks != 0)
+    {
+        cout << "key-value:     " << kvBlocks << " log blocks" << endl;
+    }
+    if(commitRecords != 0)
+    {
+        cout << "transaction:   interrupted after the commit, finished by lf_init" << endl;
+    }
+    if(swapRecords != 0)
+    {
+        cout << "copied files:  " << swapRecords << " interrupted, finished or undone by lf_init" << endl;
+    }
+    if(tableBlocks != 0)
+    {
+        cout << "bad blocks:    " << badBlocks << " retired, " << replacedBlocks << " of them replaced by other blocks" << endl;
+    }
+    cout << "lost blocks:   " << orphanBlocks << " (not reachable from any file)" << endl;
+
+    return 0;
+}
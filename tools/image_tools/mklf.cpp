@@ -0,0 +1,233 @@
+// mklf - packs a directory into a LightFiles memory image
+//
+// usage: mklf -b <block size> -n <block count> [-p <page size>] [-r] [-z <window bits>] <directory> <image>
+//   -p  program page size of the memory
+//   -r  the memory is rewritable (EEPROM, FRAM)
+//   -z  compresses the files with a window of 2^bits bytes (built with LF_USE_COMPRESSION),
+//       the files which would not take fewer blocks are stored uncompressed
+//
+// Each file in the directory is stored under the key given by the number its name
+// starts with (e.g. "12", "12.bin" or "12_config.json"), other files are ignored.
+// The image is created (or overwritten) erased, and the files are written one after
+// another, so each of them occupies contiguous blocks.
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include "light_files.h"
+#include "memory_impl.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+struct InputFile {
+    uint8_t key;
+    fs::path path;
+    vector<uint8_t> content;
+    size_t blocks;
+    bool compressed;
+};
+
+static int usage()
+{
+    cerr << "usage: mklf -b <block size> -n <block count> [-p <page size>] [-r] [-z <window bits>] <directory> <image>" << endl;
+    return 1;
+}
+
+// counts the blocks used in the memory
+static size_t used_blocks(uint16_t blockCount)
+{
+    size_t count = 0;
+    for(uint16_t block = 0; block < blockCount; ++block)
+    {
+        uint8_t info;
+        if(lf_app_read(block, 0, &info, 1) != LF_RESULT_SUCCESS)
+        {
+            return blockCount;
+        }
+        count += (info != 0xff);
+    }
+    return count;
+}
+
+#if LF_USE_COMPRESSION
+// stores the file compressed in a scratch memory of its plain size, returns the number of blocks it takes
+// or 0 if it does not take fewer blocks than stored uncompressed
+static size_t compressed_blocks(InputFile &file, uint16_t blockSize, uint16_t pageSize, uint8_t flags, vector<uint8_t> &workspace)
+{
+    vector<uint8_t> scratch((file.blocks + 1) * blockSize, 0xff);
+    memory_config(scratch.data(), (uint16_t)(file.blocks + 1), blockSize, pageSize, flags);
+    size_t formatted = 0, stored = 0;
+    lf_result_t result = lf_init();
+    if(result == LF_RESULT_SUCCESS) result = lf_format();
+    if(result == LF_RESULT_SUCCESS) formatted = used_blocks((uint16_t)(file.blocks + 1));
+    if(result == LF_RESULT_SUCCESS) result = lf_create_compressed(file.key, workspace.data(), workspace.size());
+    if(result == LF_RESULT_SUCCESS) result = lf_write(file.content.data(), file.content.size());
+    if(result == LF_RESULT_SUCCESS) result = lf_save();
+    if(result == LF_RESULT_SUCCESS) stored = used_blocks((uint16_t)(file.blocks + 1)) - formatted;
+    return (result == LF_RESULT_SUCCESS && stored < file.blocks) ? stored : 0;
+}
+#endif
+
+// returns the key of the file, or -1 if the name does not start with a valid key
+static int parse_key(const string &name)
+{
+    size_t digits = 0;
+    while(digits < name.size() && isdigit((unsigned char)name[digits]))
+    {
+        ++digits;
+    }
+    if(digits == 0 || digits > 3 || (digits < name.size() && isalnum((unsigned char)name[digits])))
+    {
+        return -1;
+    }
+    int key = atoi(name.substr(0, digits).c_str());
+    return (key <= 126) ? key : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long blockSize = 0, blockCount = 0, pageSize = 0, windowBits = 0;
+    uint8_t flags = 0;
+    vector<const char*> positional;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) blockSize = strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) blockCount = strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc) pageSize = strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-r") == 0) flags |= LF_MEMORY_FLAG_REWRITABLE;
+#if LF_USE_COMPRESSION
+        else if(strcmp(argv[i], "-z") == 0 && i + 1 < argc) windowBits = strtoul(argv[++i], NULL, 0);
+#endif
+        else if(argv[i][0] == '-') return usage();
+        else positional.push_back(argv[i]);
+    }
+    if(positional.size() != 2 || blockSize == 0 || blockSize > 0xffff || blockCount == 0 || blockCount >= 0xffff || pageSize > 0xffff || windowBits > 12)
+    {
+        return usage();
+    }
+
+    // collect the files
+    vector<InputFile> files;
+    vector<bool> usedKeys(127, false);
+    error_code ec;
+    for(const fs::directory_entry &entry : fs::directory_iterator(positional[0], ec))
+    {
+        if(!entry.is_regular_file()) continue;
+        int key = parse_key(entry.path().filename().string());
+        if(key < 0)
+        {
+            cerr << "skipping " << entry.path() << " - name does not start with a key" << endl;
+            continue;
+        }
+        if(usedKeys[key])
+        {
+            cerr << "error: key " << key << " is used by more than one file" << endl;
+            return 1;
+        }
+        usedKeys[key] = true;
+
+        InputFile file;
+        file.key = (uint8_t)key;
+        file.path = entry.path();
+        file.compressed = false;
+        ifstream stream(file.path, ios::binary);
+        file.content.assign(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+        if(!stream.good() && !stream.eof())
+        {
+            cerr << "error: can not read " << file.path << endl;
+            return 1;
+        }
+        files.push_back(move(file));
+    }
+    if(ec)
+    {
+        cerr << "error: can not open directory " << positional[0] << endl;
+        return 1;
+    }
+
+#if LF_USE_COMPRESSION
+    vector<uint8_t> workspace(windowBits ? LF_COMPRESSION_WORKSPACE_SIZE(windowBits) : 0);
+#endif
+
+    // check if everything fits, the files are compressed only if they take fewer blocks then
+    const size_t headerSize = 5 + (LF_USE_CRC ? 4 : 0);
+    const size_t leadingHeaderSize = headerSize + (LF_USE_RECORDS ? 7 : ((LF_USE_COMPRESSION || LF_USE_TRANSACTIONS) ? 5 : 0));
+    size_t contentSize = blockSize - headerSize;
+    size_t requiredBlocks = 0;
+    for(InputFile &file : files)
+    {
+        size_t rest = (file.content.size() <= blockSize - leadingHeaderSize) ? 0 : file.content.size() - (blockSize - leadingHeaderSize);
+        file.blocks = 1 + (rest + contentSize - 1) / contentSize;
+#if LF_USE_COMPRESSION
+        size_t blocks = (windowBits != 0 && file.blocks > 1 && file.blocks < 0xffff) ? compressed_blocks(file, (uint16_t)blockSize, (uint16_t)pageSize, flags, workspace) : 0;
+        if(blocks != 0)
+        {
+            file.blocks = blocks;
+            file.compressed = true;
+        }
+#endif
+        requiredBlocks += file.blocks;
+    }
+    if(requiredBlocks > blockCount)
+    {
+        cerr << "error: files need " << requiredBlocks << " blocks, the image has " << blockCount << endl;
+        return 1;
+    }
+
+    // files are stored in the order of the keys
+    sort(files.begin(), files.end(), [](const InputFile &a, const InputFile &b) {return a.key < b.key;});
+
+    fs::remove(positional[1], ec);
+    if(!memory_open_image(positional[1], (uint16_t)blockCount, (uint16_t)blockSize, (uint16_t)pageSize, flags))
+    {
+        cerr << "error: can not open image " << positional[1] << endl;
+        return 1;
+    }
+
+    lf_result_t result = lf_init();
+    if(result == LF_RESULT_SUCCESS) result = lf_format();
+    for(size_t i = 0; i < files.size() && result == LF_RESULT_SUCCESS; ++i)
+    {
+        InputFile &file = files[i];
+#if LF_USE_COMPRESSION
+        if(file.compressed)
+        {
+            result = lf_create_compressed(file.key, workspace.data(), workspace.size());
+        }
+        else
+#endif
+        result = lf_create(file.key);
+        if(result == LF_RESULT_SUCCESS) result = lf_write(file.content.data(), file.content.size());
+        if(result == LF_RESULT_SUCCESS) result = lf_save();
+        if(result != LF_RESULT_SUCCESS)
+        {
+            cerr << "error: can not store " << file.path << " (result " << result << ")" << endl;
+        }
+        else
+        {
+            cout << "key " << (int)file.key << ": " << file.path.filename().string() << ", " << file.content.size() << " bytes"
+                 << ((windowBits != 0 && !file.compressed) ? ", stored uncompressed" : "") << endl;
+        }
+    }
+
+    // count the used blocks
+    size_t usedBlocks = (result == LF_RESULT_SUCCESS) ? used_blocks((uint16_t)blockCount) : 0;
+
+    memory_close_image();
+
+    if(result != LF_RESULT_SUCCESS)
+    {
+        return 1;
+    }
+
+    cout << files.size() << " files, " << usedBlocks << " of " << blockCount << " blocks used" << endl;
+    return 0;
+}